@@ -2,6 +2,14 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 #define arrpush(da, item)                                                                \
   {                                                                                    \
@@ -31,18 +39,46 @@ typedef enum {
 } Command;
 
 arrdef(Command, Command);
+
+// the optimized program. inside a run of code without brackets the
+// pointer doesn't really move: every Add, Out and In works at an offset
+// from it, and a single Move at the end of the run applies the total.
+// jumps know their target, so brackets don't scan for their match
+typedef enum {
+  Add,  // data[dp+offset] += arg
+  Move, // dp += arg
+  Out,  // putchar(data[dp+offset])
+  In,   // data[dp+offset] = getchar()
+  Jz,   // if data[dp] == 0 go to arg
+  Jnz,  // if data[dp] != 0 go to arg
+} Op;
+
+// eight bytes, so the cache stays small
+typedef struct {
+  uint16_t op;
+  int16_t offset;
+  int32_t arg;
+} Instr;
+
+arrdef(Instr, Instr);
+arrdef(size_t, Size);
+arrdef(char, Char);
+
 typedef struct {
   CommandArray code;
+  InstrArray ops;
   size_t ip;
   char data[30000];
   size_t dp;
+  FILE* in;
+  FILE* out;
 } VM;
 
 
-VM parse(char* src, int size) {
+VM parse(char* src, size_t size) {
   CommandArray c = {0};
   
-  for (int i=0; i<size; ++i) {
+  for (size_t i=0; i<size; ++i) {
     switch(src[i]) {
       case '>': arrpush(c, Right); break;
       case '<': arrpush(c, Left); break;
@@ -58,9 +94,85 @@ VM parse(char* src, int size) {
 
   VM vm = { 0 };
   vm.code = c;
+  vm.in = stdin;
+  vm.out = stdout;
   return vm;
 }
 
+// adds n to the cell at offset, merging with an Add to the same cell
+// since the start of the block. adds has a slot for every 16 bit
+// offset with the index of its last Add plus one; a slot pointing
+// before the block is left over from an older one and is ignored,
+// so nothing has to be cleared when a block starts
+void add_at(InstrArray* ops, size_t* adds, size_t block, int offset, int n) {
+  size_t* slot = &adds[offset - INT16_MIN];
+  if (*slot > block && *slot <= ops->len) {
+    Instr* add = &ops->data[*slot - 1];
+    if (add->op == Add && add->offset == offset) {
+      add->arg += n;
+      return;
+    }
+  }
+  arrpush(*ops, ((Instr) { Add, offset, n }));
+  *slot = ops->len;
+}
+
+InstrArray optimize(CommandArray* code) {
+  InstrArray ops = {0};
+  SizeArray opens = {0};
+  size_t* adds = calloc(1 << 16, sizeof(size_t));
+  // first instruction whose Add can still be merged, and where the
+  // pointer would be if the moves weren't deferred
+  size_t block = 0;
+  int move = 0;
+
+  for (size_t i=0; i<code->len; ++i) {
+    Command cmd = code->data[i];
+    // offsets have 16 bits: a longer run moves the pointer before it
+    bool far = move < INT16_MIN + 1 || move > INT16_MAX - 1;
+    if (cmd == Open || cmd == Close || far) {
+      if (move != 0) arrpush(ops, ((Instr) { Move, 0, move }));
+      if (far) block = ops.len;
+      move = 0;
+    }
+
+    switch (cmd) {
+      case Left:  move -= 1; break;
+      case Right: move += 1; break;
+      case Plus:  add_at(&ops, adds, block, move, 1); break;
+      case Minus: add_at(&ops, adds, block, move, -1); break;
+      // an Add after I/O can't be merged with one before it
+      case Dot:   arrpush(ops, ((Instr) { Out, move, 0 })); block = ops.len; break;
+      case Comma: arrpush(ops, ((Instr) { In, move, 0 })); block = ops.len; break;
+      case Open: {
+        arrpush(opens, ops.len);
+        arrpush(ops, ((Instr) { Jz, 0, 0 }));
+        block = ops.len;
+        break;
+      }
+      case Close: {
+        // like exec, an unmatched ] goes back to the start
+        size_t target = 0;
+        if (opens.len > 0) {
+          size_t open = opens.data[--opens.len];
+          target = open + 1;
+          ops.data[open].arg = ops.len + 1;
+        }
+        arrpush(ops, ((Instr) { Jnz, 0, target }));
+        block = ops.len;
+        break;
+      }
+    }
+  }
+  if (move != 0) arrpush(ops, ((Instr) { Move, 0, move }));
+
+  // and an unmatched [ skips to the end
+  while (opens.len > 0) ops.data[opens.data[--opens.len]].arg = ops.len;
+  free(opens.data);
+  free(adds);
+  return ops;
+}
+
 bool done(VM* vm) {
   return vm->ip >= vm->code.len;
 }
@@ -74,8 +186,8 @@ void exec(VM* vm) {
     case Right: vm->dp += 1; break;
     case Plus:  vm->data[vm->dp] += 1; break;
     case Minus: vm->data[vm->dp] -= 1; break;
-    case Dot:   putchar(vm->data[vm->dp]);    break;
-    case Comma: vm->data[vm->dp] = getchar(); break;
+    case Dot:   fputc(vm->data[vm->dp], vm->out);    break;
+    case Comma: vm->data[vm->dp] = fgetc(vm->in); break;
     case Open:  {
       if (vm->data[vm->dp] != 0) break;
 
@@ -124,42 +236,716 @@ void exec(VM* vm) {
   }
 }
 
-char* read_file_to_string(char* filename) {
+// runs the optimized program to the end. the pointer and the
+// instruction index stay in locals, only the cells go through memory
+void run(VM* vm) {
+  Instr* ops = vm->ops.data;
+  size_t len = vm->ops.len;
+  char* data = vm->data;
+  size_t dp = vm->dp;
+
+  for (size_t ip=0; ip<len; ++ip) {
+    Instr in = ops[ip];
+    switch (in.op) {
+      case Add:  data[dp + in.offset] += in.arg; break;
+      case Move: dp += in.arg; break;
+      case Out:  fputc(data[dp + in.offset], vm->out); break;
+      case In:   data[dp + in.offset] = fgetc(vm->in); break;
+      case Jz:   if (data[dp] == 0) ip = in.arg - 1; break;
+      case Jnz:  if (data[dp] != 0) ip = in.arg - 1; break;
+    }
+  }
+
+  vm->dp = dp;
+  vm->ip = vm->code.len;
+}
+
+// programs for --check. the ones with input read CHECK_INPUT
+char* CHECK_CORPUS[] = {
+  // hello world
+  "++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++.>>.<-.<.+++.------.--------.>>+.>++.",
+  // offsets and a move at the end of the block
+  ">+>>-<<<+++>>>>+++++[<+++++++>-]<.>>+<<<<<.",
+  // cat until a zero or the end of the input
+  ",[.,]",
+  // multiplication, 7 * 9 = 63 = '?'
+  "+++++++[>+++++++++<-]>.",
+  // nested loops, printing the counters
+  "+++[>+++[>+++<-]>[>+<-]<<-]>>>+++++++++++++++++++++++++++++++++++++++++++.",
+  // clear loops and a cell that wraps around
+  "+++++[-]-.[+]++++++++++++++++++++++++++++++++++++++++++++++++++.",
+  // input at offsets
+  ">>,<<,>.<<.>>>,.",
+  // unmatched brackets
+  "[+++]++++++++++++++++++++++++++++++++++++++++++++++++++.",
+  "+++++++++++++++++++++++++++++++++++++++++++++++++.]",
+};
+#define CHECK_CORPUS_COUNT (int) (sizeof(CHECK_CORPUS) / sizeof(char*))
+#define CHECK_INPUT "brainfuck\0input"
+
+// a random program that never goes left of where it starts, and comes
+// back there at the end. a loop body starts one cell to the right of
+// its counter, so only the - at the end of the body touches it
+void random_program(char* buf, int len, int depth) {
+  int pos = 0, move = 0;
+  while (pos < len) {
+    int r = rand() % 12;
+    if (r < 3) {
+      buf[pos++] = '+';
+    } else if (r < 5) {
+      buf[pos++] = '-';
+    } else if (r < 7) {
+      buf[pos++] = '>'; move++;
+    } else if (r < 9 && move > 0) {
+      buf[pos++] = '<'; move--;
+    } else if (r == 9) {
+      buf[pos++] = rand() % 4 ? '.' : ',';
+    } else if (depth > 0 && pos + 8 < len) {
+      // most loops count down from a few, some run on whatever is there
+      if (rand() % 4) {
+        pos += sprintf(&buf[pos], "[-]");
+        for (int n=rand() % 4 + 1; n > 0; --n) buf[pos++] = '+';
+      }
+      char body[256];
+      int body_len = rand() % 12 + 1;
+      random_program(body, body_len, depth - 1);
+      pos += sprintf(&buf[pos], "[>%s<-", body);
+      buf[pos++] = ']';
+    }
+  }
+  for (; move > 0; --move) buf[pos++] = '<';
+  buf[pos] = 0;
+}
+
+// runs a program with exec and with the optimized ops on the same input,
+// and compares the output, the pointer and the tape.
+// returns -1 if exec didn't finish within max_steps
+int check_program(char* src, int max_steps) {
+  static VM a, b;
+  char* out_a = NULL, *out_b = NULL;
+  size_t out_a_len = 0, out_b_len = 0;
+
+  a = parse(src, strlen(src));
+  a.dp = b.dp = 15000;
+  a.in = fmemopen(CHECK_INPUT, sizeof(CHECK_INPUT), "r");
+  a.out = open_memstream(&out_a, &out_a_len);
+  int steps = 0;
+  while (!done(&a) && steps < max_steps) {
+    exec(&a);
+    steps++;
+  }
+  fclose(a.in);
+  fclose(a.out);
+  if (!done(&a)) {
+    free(out_a);
+    free(a.code.data);
+    return -1;
+  }
+
+  b = parse(src, strlen(src));
+  b.dp = 15000;
+  b.ops = optimize(&b.code);
+  b.in = fmemopen(CHECK_INPUT, sizeof(CHECK_INPUT), "r");
+  b.out = open_memstream(&out_b, &out_b_len);
+  run(&b);
+  fclose(b.in);
+  fclose(b.out);
+
+  bool same = out_a_len == out_b_len && memcmp(out_a, out_b, out_a_len) == 0
+    && a.dp == b.dp && memcmp(a.data, b.data, sizeof(a.data)) == 0;
+  if (!same) {
+    printf("MISMATCH: %s\n", src);
+    printf("  exec: dp %zu, output \"%.*s\"\n", a.dp, (int) out_a_len, out_a);
+    printf("  run:  dp %zu, output \"%.*s\"\n", b.dp, (int) out_b_len, out_b);
+  }
+
+  free(out_a);
+  free(out_b);
+  free(a.code.data);
+  free(b.code.data);
+  free(b.ops.data);
+  return same;
+}
+
+int check(int random_count) {
+  int failed = 0, skipped = 0;
+  size_t commands = 0, ops = 0;
+
+  for (int i=0; i<CHECK_CORPUS_COUNT; ++i) {
+    if (check_program(CHECK_CORPUS[i], 10000000) != 1) failed++;
+
+    VM vm = parse(CHECK_CORPUS[i], strlen(CHECK_CORPUS[i]));
+    InstrArray opt = optimize(&vm.code);
+    commands += vm.code.len;
+    ops += opt.len;
+    free(opt.data);
+    free(vm.code.data);
+  }
+
+  srand(1);
+  char src[4096];
+  for (int i=0; i<random_count; ++i) {
+    random_program(src, 40 + rand() % 200, 3);
+    int result = check_program(src, 100000);
+    if (result < 0) skipped++;
+    else if (result == 0) failed++;
+  }
+
+  printf("corpus: %d programs, %zu commands -> %zu instructions\n", CHECK_CORPUS_COUNT, commands, ops);
+  printf("random: %d programs, %d too long and skipped\n", random_count, skipped);
+  printf("%d mismatches\n", failed);
+  return failed > 0;
+}
+
+// reads the whole file, also when it isn't a regular one (a pipe).
+// the string is terminated, size doesn't count the terminator
+char* read_file_to_string(char* filename, size_t* size) {
   FILE* f = fopen(filename, "rb");
   if (!f) {
     perror("File could not be opened");
     return NULL;
   }
 
-  fseek(f, 0, SEEK_END);
-  int size = ftell(f);
-  char* buf = malloc(size+1);
+  size_t cap = 4096, len = 0;
+  char* buf = malloc(cap);
+  while (buf != NULL) {
+    len += fread(buf + len, 1, cap - len - 1, f);
+    if (len < cap - 1) break;
+    cap *= 2;
+    // on failure realloc leaves the old buffer, which is still ours to free
+    char* bigger = realloc(buf, cap);
+    if (bigger == NULL) free(buf);
+    buf = bigger;
+  }
   if (!buf) {
     perror("No memory avaible for file");
+    fclose(f);
     return NULL;
   }
-  fseek(f, 0, SEEK_SET);
-  int read = fread(buf, 1, size, f);
-  if (read != size) {
+  if (ferror(f)) {
     perror("Error while reading file");
+    free(buf);
+    fclose(f);
     return NULL;
   }
 
   fclose(f);
-  buf[size+1] = 0;
+  buf[len] = 0;
+  *size = len;
   return buf;
 }
 
+// maps a regular file instead of copying it. the mapping isn't
+// terminated: parse goes by the size. free_file knows which one it was
+char* map_file(char* filename, size_t* size, bool* mapped) {
+  *mapped = false;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror("File could not be opened");
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return read_file_to_string(filename, size);
+  }
+
+  char* src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (src == MAP_FAILED) return read_file_to_string(filename, size);
+  *size = st.st_size;
+  *mapped = true;
+  return src;
+}
+
+void free_file(char* src, size_t size, bool mapped) {
+  if (mapped) munmap(src, size);
+  else free(src);
+}
+
+uint64_t mix(uint64_t h, uint64_t w) {
+  h = (h ^ w) * 0xff51afd7ed558ccd;
+  return h ^ (h >> 32);
+}
+
+// not a cryptographic hash: eight bytes at a time, each mixed in with
+// a multiply. four independent lanes keep the multiplier busy.
+// it tells a source or a cache from a changed one
+uint64_t hash(const void* data, size_t len) {
+  const uint8_t* p = data;
+  uint64_t lanes[4] = { 0x9e3779b97f4a7c15 ^ len, 1, 2, 3 };
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    for (int j=0; j<4; ++j) {
+      uint64_t w;
+      memcpy(&w, p + i + j*8, 8);
+      lanes[j] = mix(lanes[j], w);
+    }
+  }
+  uint64_t h = mix(mix(mix(lanes[0], lanes[1]), lanes[2]), lanes[3]);
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, 8);
+    h = mix(h, w);
+  }
+  uint64_t w = 0;
+  if (len > i) memcpy(&w, p + i, len - i);
+  h = (h ^ w) * 0xff51afd7ed558ccd;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53;
+  return h ^ (h >> 33);
+}
+
+// the cache of a source file is file.bfc next to it: a header, then the
+// optimized ops exactly as they are in memory, so loading is one mmap.
+// the key is the hash of the source. size and mtime are kept too: when
+// they match, the source isn't even opened. a cache from another version,
+// or whose ops don't match their hash, is rebuilt
+#define CACHE_MAGIC "BFC"
+#define CACHE_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t instr_size;
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint64_t source_hash;
+  uint64_t commands;
+  uint64_t ops;
+  uint64_t ops_hash;
+} CacheHeader;
+
+int64_t mtime_ns(struct stat* st) {
+  return (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+bool cache_load(char* cache_path, char* source_path, struct stat* source, VM* vm) {
+  int fd = open(cache_path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+  uint8_t* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return false;
+
+  CacheHeader* h = (CacheHeader*) base;
+  Instr* ops = (Instr*) (base + sizeof(CacheHeader));
+  bool ok = memcmp(h->magic, CACHE_MAGIC, 4) == 0
+    && h->version == CACHE_VERSION
+    && h->instr_size == sizeof(Instr)
+    && h->source_size == (uint64_t) source->st_size
+    && h->ops == (st.st_size - sizeof(CacheHeader)) / sizeof(Instr)
+    && (st.st_size - sizeof(CacheHeader)) % sizeof(Instr) == 0;
+
+  if (ok && h->source_mtime != mtime_ns(source)) {
+    size_t size;
+    bool mapped;
+    char* src = map_file(source_path, &size, &mapped);
+    ok = src != NULL && size == h->source_size && hash(src, size) == h->source_hash;
+    if (src != NULL) free_file(src, size, mapped);
+  }
+  ok = ok && hash(ops, h->ops * sizeof(Instr)) == h->ops_hash;
+
+  if (!ok) {
+    munmap(base, st.st_size);
+    return false;
+  }
+
+  // the ops stay mapped until the end
+  vm->ops = (InstrArray) { 0, h->ops, ops };
+  vm->code.len = h->commands;
+  return true;
+}
+
+// written aside and renamed, so a cache is never seen half written
+void cache_save(char* cache_path, struct stat* source, char* src, size_t size, VM* vm) {
+  CacheHeader h = { CACHE_MAGIC, CACHE_VERSION, sizeof(Instr), size, mtime_ns(source),
+    hash(src, size), vm->code.len, vm->ops.len, hash(vm->ops.data, vm->ops.len * sizeof(Instr)) };
+
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.%d", cache_path, getpid());
+  FILE* f = fopen(tmp, "wb");
+  if (!f) return;
+  fwrite(&h, sizeof(h), 1, f);
+  if (vm->ops.len > 0) fwrite(vm->ops.data, sizeof(Instr), vm->ops.len, f);
+  bool ok = !ferror(f);
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp, cache_path) < 0) unlink(tmp);
+}
+
+double time_now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+long peak_rss_kb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+void append(CharArray* a, char* s) {
+  for (; *s; ++s) arrpush(*a, *s);
+}
+
+void repeat(CharArray* a, char c, int n) {
+  for (int i=0; i<n; ++i) arrpush(*a, c);
+}
+
+// moves the pointer of a generated program to cell to
+void go(CharArray* a, int* pos, int to) {
+  repeat(a, to > *pos ? '>' : '<', abs(to - *pos));
+  *pos = to;
+}
+
+// the programs of --bench. every one builds its source, the input it
+// reads and the output it has to print. the expected output is worked
+// out here, not by running a VM
+#define HELLO "++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++.>>.<-.<.+++.------.--------.>>+.>++."
+
+void bench_hello(CharArray* src, CharArray* input, CharArray* expected) {
+  (void) input;
+  append(src, HELLO);
+  append(expected, "Hello World!\n");
+}
+
+// prints every number of five digits, one per line: nested counting
+// loops and a lot of output. cell 2i counts down the iterations of
+// digit i, cell 2i+1 is its character and the last cell a newline
+void bench_count(CharArray* src, CharArray* input, CharArray* expected) {
+  (void) input;
+  int digits = 5, pos = 0;
+  go(src, &pos, 2*digits);
+  repeat(src, '+', 10);
+  for (int i=0; i<digits; ++i) {
+    go(src, &pos, 2*i);
+    repeat(src, '+', 10);
+    go(src, &pos, 2*i+1);
+    append(src, "[-]");
+    repeat(src, '+', '0');
+    go(src, &pos, 2*i);
+    append(src, "[");
+  }
+  for (int i=0; i<digits; ++i) {
+    go(src, &pos, 2*i+1);
+    append(src, ".");
+  }
+  go(src, &pos, 2*digits);
+  append(src, ".");
+  for (int i=digits-1; i>=0; --i) {
+    go(src, &pos, 2*i+1);
+    append(src, "+");
+    go(src, &pos, 2*i);
+    append(src, "-]");
+  }
+
+  char line[16];
+  for (int n=0; n<100000; ++n) {
+    sprintf(line, "%05d\n", n);
+    append(expected, line);
+  }
+}
+
+// three loops of 200 inside each other around a single increment
+void bench_loops(CharArray* src, CharArray* input, CharArray* expected) {
+  (void) input;
+  int n = 200;
+  for (int i=0; i<3; ++i) {
+    repeat(src, '+', n);
+    append(src, "[>");
+  }
+  append(src, "+<-]<-]<-]>>>");
+  repeat(src, '+', 'A');
+  append(src, ".");
+  arrpush(*expected, (char) (n * n * n + 'A'));
+}
+
+// brackets nested ten thousand deep, each loop running once
+void bench_deep(CharArray* src, CharArray* input, CharArray* expected) {
+  (void) input;
+  int depth = 10000;
+  append(src, "+");
+  for (int i=0; i<depth; ++i) append(src, "[>+");
+  for (int i=0; i<depth; ++i) append(src, "[-]<-]");
+  for (int i=0; i<20; ++i) append(src, "++++++++++++++++++++++++++++++++++++++++++++++++++++.[-]");
+  for (int i=0; i<20; ++i) append(expected, "4");
+}
+
+// a long program without much looping, where parsing counts
+void bench_long(CharArray* src, CharArray* input, CharArray* expected) {
+  (void) input;
+  for (int i=0; i<20000; ++i) {
+    append(src, HELLO "[-]<[-]<[-]<[-]<[-]<[-]<[-]");
+    append(expected, "Hello World!\n");
+  }
+}
+
+// copies eight MB of input to the output, up to the zero at the end
+void bench_echo(CharArray* src, CharArray* input, CharArray* expected) {
+  append(src, ",[.,]");
+  for (int i=0; i<8000000; ++i) arrpush(*input, i % 255 + 1);
+  for (size_t i=0; i<input->len; ++i) arrpush(*expected, input->data[i]);
+  arrpush(*input, 0);
+}
+
+typedef struct {
+  char* name;
+  void (*build)(CharArray* src, CharArray* input, CharArray* expected);
+} BenchProgram;
+
+const BenchProgram BENCH_PROGRAMS[] = {
+  { "hello", bench_hello },
+  { "count", bench_count },
+  { "loops", bench_loops },
+  { "deep",  bench_deep },
+  { "long",  bench_long },
+  { "echo",  bench_echo },
+};
+#define BENCH_PROGRAMS_COUNT (int) (sizeof(BENCH_PROGRAMS) / sizeof(BenchProgram))
+
+// every way the VM can run a program, loading included
+char* BENCH_MODES[] = { "naive", "ops", "cache" };
+#define BENCH_MODES_COUNT (int) (sizeof(BENCH_MODES) / sizeof(char*))
+
+typedef struct {
+  bool ok;
+  double us;
+  long rss_kb;
+  size_t steps;
+} BenchResult;
+
+// runs in a child process, so the peak rss is only its own
+BenchResult bench_run(int mode, char* path, CharArray* src, CharArray* input, CharArray* expected) {
+  static VM vm;
+  BenchResult r = {0};
+  char* out = NULL;
+  size_t out_len = 0;
+  double start = time_now_us();
+
+  vm = parse(NULL, 0);
+  if (mode == 2) {
+    struct stat st;
+    char cache_path[4096];
+    snprintf(cache_path, sizeof(cache_path), "%s.bfc", path);
+    if (stat(path, &st) < 0 || !cache_load(cache_path, path, &st, &vm)) return r;
+  } else {
+    vm = parse(src->data, src->len);
+  }
+  vm.in = fmemopen(input->data, input->len, "r");
+  vm.out = open_memstream(&out, &out_len);
+
+  if (mode == 0) {
+    while (!done(&vm)) {
+      exec(&vm);
+      r.steps++;
+    }
+  } else {
+    if (mode == 1) vm.ops = optimize(&vm.code);
+    run(&vm);
+  }
+  fclose(vm.out);
+  r.us = time_now_us() - start;
+  fclose(vm.in);
+
+  r.ok = out_len == expected->len && memcmp(out, expected->data, out_len) == 0;
+  r.rss_kb = peak_rss_kb();
+  free(out);
+  return r;
+}
+
+// throughput is in brainfuck commands a second: the commands the naive
+// VM executes, over the time of each mode. it's the same work for all
+// the modes, so they compare. the best of a few runs is kept.
+// with a baseline file, a mode that got slower than threshold percent
+// fails the run, like a wrong output does. --update writes the baseline
+// instead
+int bench(int argc, char** argv) {
+  char* baseline = NULL;
+  bool update = false;
+  double threshold = 20;
+  int runs = 3;
+  for (int i=0; i<argc; ++i) {
+    if (strcmp(argv[i], "--baseline") == 0 && i+1 < argc) baseline = argv[++i];
+    else if (strcmp(argv[i], "--update") == 0) update = true;
+    else if (strcmp(argv[i], "--threshold") == 0 && i+1 < argc) threshold = atof(argv[++i]);
+    else if (strcmp(argv[i], "--runs") == 0 && i+1 < argc) runs = atoi(argv[++i]);
+    else {
+      fprintf(stderr, "usage: --bench [--baseline file [--update]] [--threshold percent] [--runs n]\n");
+      return 2;
+    }
+  }
+
+  double expected_rates[BENCH_PROGRAMS_COUNT][BENCH_MODES_COUNT] = {0};
+  FILE* f = baseline != NULL && !update ? fopen(baseline, "r") : NULL;
+  if (f != NULL) {
+    char name[64], mode[64];
+    double rate;
+    while (fscanf(f, "%63s %63s %lf", name, mode, &rate) == 3) {
+      for (int i=0; i<BENCH_PROGRAMS_COUNT; ++i) {
+        for (int j=0; j<BENCH_MODES_COUNT; ++j) {
+          if (strcmp(name, BENCH_PROGRAMS[i].name) == 0 && strcmp(mode, BENCH_MODES[j]) == 0) {
+            expected_rates[i][j] = rate;
+          }
+        }
+      }
+    }
+    fclose(f);
+  } else if (baseline != NULL && !update) {
+    perror(baseline);
+    return 2;
+  }
+
+  // the results come back from the children through a shared page
+  BenchResult* shared = mmap(NULL, sizeof(BenchResult), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  double rates[BENCH_PROGRAMS_COUNT][BENCH_MODES_COUNT] = {0};
+  int mismatches = 0, regressions = 0;
+
+  for (int i=0; i<BENCH_PROGRAMS_COUNT; ++i) {
+    CharArray src = {0}, input = {0}, expected = {0};
+    BENCH_PROGRAMS[i].build(&src, &input, &expected);
+
+    // the cache mode loads a cache built beforehand
+    char path[] = "/tmp/brainfuck-bench-XXXXXX";
+    int fd = mkstemp(path);
+    write(fd, src.data, src.len);
+    close(fd);
+    struct stat st;
+    stat(path, &st);
+    static VM vm;
+    vm = parse(src.data, src.len);
+    vm.ops = optimize(&vm.code);
+    char cache_path[4096];
+    snprintf(cache_path, sizeof(cache_path), "%s.bfc", path);
+    cache_save(cache_path, &st, src.data, src.len, &vm);
+    free(vm.code.data);
+    free(vm.ops.data);
+
+    size_t steps = 0;
+    for (int j=0; j<BENCH_MODES_COUNT; ++j) {
+      BenchResult best = {0};
+      for (int run=0; run<runs; ++run) {
+        // a child that crashes leaves it zeroed, so it doesn't pass
+        memset(shared, 0, sizeof(BenchResult));
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+          *shared = bench_run(j, path, &src, &input, &expected);
+          exit(0);
+        }
+        waitpid(pid, NULL, 0);
+        if (run == 0 || !shared->ok || shared->us < best.us) best = *shared;
+        if (!shared->ok) break;
+      }
+      if (j == 0) steps = best.steps;
+      rates[i][j] = steps / best.us;
+
+      printf("%-6s %-6s %10.1f ms  %8.1f Mcmd/s  peak rss %6.1f MB  %s",
+        BENCH_PROGRAMS[i].name, BENCH_MODES[j], best.us / 1e3, rates[i][j],
+        best.rss_kb / 1e3, best.ok ? "ok" : "WRONG OUTPUT");
+      if (!best.ok) mismatches++;
+      if (expected_rates[i][j] > 0) {
+        double change = (rates[i][j] / expected_rates[i][j] - 1) * 100;
+        // runs under 10 ms are mostly noise, they are shown but not gated
+        bool slower = change < -threshold && best.us >= 10000;
+        if (slower) regressions++;
+        printf("  %+6.1f%% from baseline%s", change, slower ? " REGRESSION" : "");
+      }
+      printf("\n");
+    }
+
+    unlink(cache_path);
+    unlink(path);
+    free(src.data);
+    free(input.data);
+    free(expected.data);
+  }
+  munmap(shared, sizeof(BenchResult));
+
+  if (baseline != NULL && update) {
+    f = fopen(baseline, "w");
+    if (f == NULL) {
+      perror(baseline);
+      return 2;
+    }
+    for (int i=0; i<BENCH_PROGRAMS_COUNT; ++i) {
+      for (int j=0; j<BENCH_MODES_COUNT; ++j) {
+        fprintf(f, "%s %s %.3f\n", BENCH_PROGRAMS[i].name, BENCH_MODES[j], rates[i][j]);
+      }
+    }
+    fclose(f);
+  }
+
+  printf("%d wrong outputs, %d regressions past %.0f%%\n", mismatches, regressions, threshold);
+  return mismatches > 0 || regressions > 0;
+}
+
 int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+    return check(argc > 2 ? atoi(argv[2]) : 10000);
+  }
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    return bench(argc - 2, argv + 2);
+  }
+
+  // --naive runs the commands one by one, without the optimized ops.
+  // --no-cache always parses the source, --time prints where time went
+  bool naive = false, use_cache = true, show_time = false;
+  while (argc > 2 && strncmp(argv[1], "--", 2) == 0) {
+    if (strcmp(argv[1], "--naive") == 0) naive = true;
+    else if (strcmp(argv[1], "--no-cache") == 0) use_cache = false;
+    else if (strcmp(argv[1], "--time") == 0) show_time = true;
+    else break;
+    argv++;
+    argc--;
+  }
+
   if (argc == 1) {
     printf("No file provided\n");
   } else if (argc > 1) {
-    char* s = read_file_to_string(argv[1]);
-    // printf("%s\n", s);
+    double start = time_now_us();
+    static VM vm;
+    vm = parse(NULL, 0);
 
-    VM vm = parse(s, strlen(s));
-    while(!done(&vm)) {
-      exec(&vm);
+    // only regular files have a cache
+    char cache_path[4096];
+    struct stat st;
+    use_cache = use_cache && !naive && stat(argv[1], &st) == 0 && S_ISREG(st.st_mode)
+      && snprintf(cache_path, sizeof(cache_path), "%s.bfc", argv[1]) < (int) sizeof(cache_path);
+    bool cached = use_cache && cache_load(cache_path, argv[1], &st, &vm);
+
+    if (!cached) {
+      size_t size;
+      bool mapped;
+      char* s = map_file(argv[1], &size, &mapped);
+      if (s == NULL) return 1;
+
+      vm = parse(s, size);
+      if (!naive) {
+        vm.ops = optimize(&vm.code);
+        if (use_cache) cache_save(cache_path, &st, s, size, &vm);
+      }
+      free_file(s, size, mapped);
+    }
+    double loaded = time_now_us();
+
+    if (naive) {
+      while(!done(&vm)) {
+        exec(&vm);
+      }
+    } else {
+      run(&vm);
+    }
+    fflush(stdout);
+
+    if (show_time) {
+      fprintf(stderr, "load %.0f us (%s), run %.0f us\n", loaded - start,
+        cached ? "cache" : use_cache ? "parsed, cache written" : "parsed", time_now_us() - loaded);
     }
 
     printf("\nExecution ended.\n");
@@ -168,4 +954,4 @@ int main(int argc, char** argv) {
   }
 
   return 0;
-}
\ No newline at end of file
+}
@@ -3,6 +3,8 @@
 #include <ctype.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <stdint.h>
 
 char* file_read_to_string(char* path) {
   FILE* f = fopen(path, "rb");
@@ -21,8 +23,9 @@ char* file_read_to_string(char* path) {
   else return buf;
 }
 
-void stdin_read_line(char* buf, int len) {
-  int c;
+// returns 0 if stdin ended before anything was read
+int stdin_read_line(char* buf, int len) {
+  int c = 0;
   int count = 0;
   
   // we keep space for newline and zero terminator, so iter until len-2
@@ -32,11 +35,14 @@ void stdin_read_line(char* buf, int len) {
     buf[count++] = c;
   }
 
+  if (c == EOF && count == 0) return 0;
+
   buf[count++] = '\n';
   buf[count] = '\0';
 
   // discard rest of stdin
-  while(c != '\n') c = getchar();
+  while(c != '\n' && c != EOF) c = getchar();
+  return 1;
 }
 
 #define VEC_PUSH(_vec, _val) \
@@ -57,8 +63,10 @@ typedef struct { \
 } _type##Vec \
 
 typedef enum {
+  End = '\0',
   ParenLeft = '(',
   ParenRight = ')',
+  Comma = ',',
   Number = 'n',
   Identifier = 'i',
   Add = '+',
@@ -68,6 +76,7 @@ typedef enum {
   Rem = '%',
   Exp = '^',
   Var = 'v',
+  Fn = 'f',
   Assign = '=',
 } TokenType;
 
@@ -85,7 +94,7 @@ Token token_sym(char c, int start) {
 }
 
 int token_is_not_op(Token* t) {
-  return t->type == Var || t->type == Assign || t->type == Number || t->type == Identifier;
+  return t->type == Var || t->type == Fn || t->type == Assign || t->type == Number || t->type == Identifier;
 }
 
 void token_dbg(TokenVec tokens, int idx) {
@@ -93,6 +102,123 @@ void token_dbg(TokenVec tokens, int idx) {
   printf("[TOKEN %d] kind = %c, col = %d, len = %d, val = %lf\n", idx, t->type, t->start, t->len, t->val);
 }
 
+// powers of ten that are exactly representable as doubles
+const double POW10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+#define MAX_EXACT_INT (1ULL << 53)
+
+int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// parses the number at the start of str in a single pass, without
+// allocating and without looking at the locale. returns its length.
+// accepts 12, 1.5, 1e-9, 2.5E+3 and 0x1F.
+//
+// when the digits fit in 53 bits and the power of ten is exact
+// (Clinger's fast path), one multiplication or division gives the
+// correctly rounded result. the rare literals that don't fit, like
+// 20+ digits or huge exponents, fall back to strtod on the same span
+int lex_number(char* str, double* out) {
+  char* c = str;
+
+  if (c[0] == '0' && (c[1] == 'x' || c[1] == 'X') && hex_digit(c[2]) != -1) {
+    c += 2;
+    uint64_t mant = 0;
+    int overflow = 0;
+    for (int d; (d = hex_digit(*c)) != -1; c++) {
+      if (mant >> 60 != 0) overflow = 1;
+      mant = mant * 16 + d;
+    }
+
+    // u64 to double conversion is correctly rounded by itself
+    *out = overflow ? strtod(str, NULL) : (double) mant;
+    return c - str;
+  }
+
+  uint64_t mant = 0;
+  int digits = 0;
+  int exp10 = 0;
+  int truncated = 0;
+
+  for (; isdigit(*c); c++) {
+    if (digits < 19) {
+      mant = mant * 10 + (*c - '0');
+      digits += mant != 0;
+    } else {
+      exp10++;
+      truncated = 1;
+    }
+  }
+
+  if (*c == '.') {
+    c++;
+    for (; isdigit(*c); c++) {
+      if (digits < 19) {
+        mant = mant * 10 + (*c - '0');
+        digits += mant != 0;
+        exp10--;
+      } else {
+        truncated = 1;
+      }
+    }
+  }
+
+  // the exponent is only taken if it has digits, "2e" is 2 followed by e
+  char* e = c;
+  if (*e == 'e' || *e == 'E') {
+    e++;
+    int sign = 1;
+    if (*e == '+' || *e == '-') sign = *e++ == '-' ? -1 : 1;
+
+    if (isdigit(*e)) {
+      int exp = 0;
+      for (; isdigit(*e); e++) {
+        if (exp < 100000) exp = exp * 10 + (*e - '0');
+      }
+      exp10 += sign * exp;
+      c = e;
+    }
+  }
+
+  int len = c - str;
+
+  if (!truncated && mant <= MAX_EXACT_INT) {
+    if (mant == 0) {
+      *out = 0;
+      return len;
+    }
+
+    if (exp10 >= 0 && exp10 <= 22) {
+      *out = (double) mant * POW10[exp10];
+      return len;
+    }
+
+    if (exp10 < 0 && exp10 >= -22) {
+      *out = (double) mant / POW10[-exp10];
+      return len;
+    }
+
+    // 123e25 is still exact as 123000e22
+    if (exp10 > 22 && exp10 <= 22 + 15) {
+      uint64_t scaled = mant;
+      for (int i=22; i<exp10 && scaled <= MAX_EXACT_INT; i++) scaled *= 10;
+      if (scaled <= MAX_EXACT_INT) {
+        *out = (double) scaled * POW10[22];
+        return len;
+      }
+    }
+  }
+
+  *out = strtod(str, NULL);
+  return len;
+}
+
 TokenVec tokenize(char* str) {
   TokenVec tokens = {0};
   int column = 0;
@@ -111,6 +237,7 @@ TokenVec tokenize(char* str) {
     switch(c) {
       case '(':
       case ')':
+      case ',':
       case '+':
       case '*':
       case '-':
@@ -121,15 +248,6 @@ TokenVec tokenize(char* str) {
         t = token_sym(c, column);
         break;
 
-      case 'v':
-        if (strncmp(str, "var", 3) == 0) {
-          t = (Token) {Var, column, 3, 0};
-        } else {
-          fprintf(stderr, "[LEX ERR] invalid keyword token at %d\n", column);
-          return (TokenVec) {0};
-        }
-        break;
-
       case '\n':
         column = 0;
         line++;
@@ -140,23 +258,21 @@ TokenVec tokenize(char* str) {
 
       default: {
         if (isdigit(c)) {
-          int len = 1;
-          while (str[len] != '\0' && isdigit(str[len])) len++;
-          if (str[len] == '.') {
-            len++;
-            while (str[len] != '\0' && isdigit(str[len])) len++;
-          }
-
-          // silly... might be better to memcpy to a buf
-          char* num = strndup(str, len);
-          double val = atof(num);
-          free(num);
-          
+          double val;
+          int len = lex_number(str, &val);
           t = (Token) {Number, column, len, val};
         } else if (isalpha(c)) {
           int len = 1;
           while (str[len] != '\0' && (isalnum(str[len]) || str[len] == '_')) len++;
-          t = (Token) {Identifier, column, len, 0};
+
+          // keywords
+          if (len == 3 && strncmp(str, "var", 3) == 0) {
+            t = (Token) {Var, column, len, 0};
+          } else if (len == 2 && strncmp(str, "fn", 2) == 0) {
+            t = (Token) {Fn, column, len, 0};
+          } else {
+            t = (Token) {Identifier, column, len, 0};
+          }
         } else {
           // handle error
           fprintf(stderr, "[LEX ERR] Invalid token (%c) at col = %d\n", c, column);
@@ -179,6 +295,9 @@ typedef enum {
   VarAssign,
   Unary,
   Binary,
+  Param,
+  BuiltinCall,
+  FnCall,
 } ExprType;
 
 typedef struct {
@@ -192,24 +311,44 @@ typedef struct {
   int rhs_idx;
 } ExprBinary;
 
+// names are stored as offsets into the program source, so the ast
+// doesn't depend on the token vector once parsing is done
 typedef struct {
-  Token* token;
+  int start;
+  int len;
+} Span;
+
+typedef struct {
+  Span name;
   int rhs_idx;
 } ExprAssign;
 
+// callee is an index in the builtin table or in the user function list,
+// depending on the expression type. the arguments are the argc
+// values on top of the eval stack
+typedef struct {
+  int callee;
+  int argc;
+} ExprCall;
+
 typedef struct {
   ExprType type;
   union {
     double val;
-    Token* var_tok;
+    Span var_name;
+    int slot;
     ExprAssign var;
     ExprUnary un;
     ExprBinary bin;
+    ExprCall call;
   };
 } Expr;
 
 VEC_DEF(Expr);
 
+typedef int Index;
+VEC_DEF(Index);
+
 Expr literal(double val) {
   return (Expr) { Literal, .val = val };
 }
@@ -225,12 +364,21 @@ Expr binary(int lhs, Token* op, int rhs) {
 }
 
 Expr var_assign(Token* t, int rhs) {
-  ExprAssign var = (ExprAssign) {t, rhs};
+  ExprAssign var = (ExprAssign) {{t->start, t->len}, rhs};
   return (Expr) { VarAssign, .var = var };
 }
 
 Expr variable(Token* t) {
-  return (Expr) { Variable, .var_tok = t };
+  return (Expr) { Variable, .var_name = {t->start, t->len} };
+}
+
+Expr param(int slot) {
+  return (Expr) { Param, .slot = slot };
+}
+
+Expr call(ExprType type, int callee, int argc) {
+  ExprCall call = (ExprCall) {callee, argc};
+  return (Expr) { type, .call = call };
 }
 
 void expr_dbg(ExprVec ast, int idx) {
@@ -245,10 +393,221 @@ void expr_dbg(ExprVec ast, int idx) {
     case Binary: 
       printf("lhs = %d, op = %c, rhs = %d\n", e->bin.lhs_idx, e->bin.op, e->bin.rhs_idx);
       break;
+    case Param: printf("slot = %d\n", e->slot); break;
+    case BuiltinCall:
+    case FnCall:
+      printf("callee = %d, argc = %d\n", e->call.callee, e->call.argc);
+      break;
     default: break; 
   }
 }
 
+// a parsed expression, ready to be evaluated.
+// it owns a copy of its source, as variable names point into it.
+// the ast is in post order, so it can be evaluated with a single
+// pass over the nodes and a value stack
+typedef struct {
+  char* src;
+  ExprVec ast;
+} Program;
+
+void program_free(Program* prog) {
+  free(prog->src);
+  VEC_FREE(prog->ast);
+}
+
+Program program_clone(Program* prog) {
+  Program res = { strdup(prog->src), prog->ast };
+  res.ast.data = malloc(res.ast.cap * sizeof(Expr));
+  memcpy(res.ast.data, prog->ast.data, res.ast.len * sizeof(Expr));
+  return res;
+}
+
+typedef struct {
+  char* name;
+  double val;
+  int defined;
+  int hash_next;
+
+  // reactive mode only: the assignment this variable was defined with,
+  // the variables it reads, and the variables that read it
+  int has_formula;
+  Program formula;
+  IndexVec deps;
+  IndexVec users;
+  unsigned mark;
+} VarEntry;
+
+VEC_DEF(VarEntry);
+
+typedef struct {
+  int var;
+  size_t edge;
+} Visit;
+
+VEC_DEF(Visit);
+
+typedef double Value;
+VEC_DEF(Value);
+
+// user defined function. parameters are read from the call frame by slot,
+// a pure function doesn't touch global variables, so calls to it
+// with constant arguments can be folded while parsing
+typedef struct {
+  char* name;
+  int arity;
+  int pure;
+  Program body;
+} FuncDef;
+
+VEC_DEF(FuncDef);
+
+typedef struct {
+  VarEntryVec vars;
+  int* var_buckets;
+  int bucket_count;
+
+  FuncDefVec funcs;
+
+  // in reactive mode assignments keep their expression,
+  // and reassigning a variable recomputes everything depending on it
+  int reactive;
+  unsigned mark;
+  VisitVec visits;
+  IndexVec order;
+
+  // constant folding can be turned off, to measure
+  // evaluation on the whole tree
+  int no_fold;
+
+  // eval value stack, function frames live in it too
+  ValueVec stack;
+} Env;
+
+void env_free(Env* env) {
+  for (size_t i=0; i<env->vars.len; i++) {
+    VarEntry* var = &env->vars.data[i];
+    free(var->name);
+    if (var->has_formula) program_free(&var->formula);
+    VEC_FREE(var->deps);
+    VEC_FREE(var->users);
+  }
+  VEC_FREE(env->vars);
+  free(env->var_buckets);
+  VEC_FREE(env->visits);
+  VEC_FREE(env->order);
+  VEC_FREE(env->stack);
+
+  for (size_t i=0; i<env->funcs.len; i++) {
+    free(env->funcs.data[i].name);
+    program_free(&env->funcs.data[i].body);
+  }  
+  VEC_FREE(env->funcs);
+}
+
+// FNV-1a
+size_t hash_bytes(char* str, size_t len) {
+  size_t h = 14695981039346656037ULL;
+  for (size_t i=0; i<len; i++) {
+    h ^= (unsigned char) str[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+int env_find_var(Env* env, char* name, int len) {
+  if (env->bucket_count == 0) return -1;
+
+  int bucket = hash_bytes(name, len) & (env->bucket_count-1);
+  for (int i = env->var_buckets[bucket]; i != -1; i = env->vars.data[i].hash_next) {
+    char* entry = env->vars.data[i].name;
+    if (strncmp(entry, name, len) == 0 && entry[len] == '\0') return i;
+  }
+
+  return -1;
+}
+
+void env_rehash_vars(Env* env) {
+  env->bucket_count = env->bucket_count == 0 ? 64 : env->bucket_count * 2;
+  env->var_buckets = realloc(env->var_buckets, env->bucket_count * sizeof(int));
+  for (int i=0; i<env->bucket_count; i++) env->var_buckets[i] = -1;
+
+  for (size_t i=0; i<env->vars.len; i++) {
+    VarEntry* var = &env->vars.data[i];
+    int bucket = hash_bytes(var->name, strlen(var->name)) & (env->bucket_count-1);
+    var->hash_next = env->var_buckets[bucket];
+    env->var_buckets[bucket] = i;
+  }
+}
+
+// adds a new, still undefined variable
+int env_add_var(Env* env, char* name, int len) {
+  VarEntry entry = { .name = strndup(name, len), .val = NAN };
+  VEC_PUSH(env->vars, entry);
+  int idx = env->vars.len-1;
+
+  if (env->vars.len > (size_t) env->bucket_count) {
+    env_rehash_vars(env);
+  } else {
+    int bucket = hash_bytes(name, len) & (env->bucket_count-1);
+    env->vars.data[idx].hash_next = env->var_buckets[bucket];
+    env->var_buckets[bucket] = idx;
+  }
+
+  return idx;
+}
+
+// latest definition wins, so redefining a function shadows the old one
+int env_find_func(Env* env, char* name, int len) {
+  for (int i=env->funcs.len-1; i>=0; i--) {
+    char* fname = env->funcs.data[i].name;
+    if (strncmp(fname, name, len) == 0 && fname[len] == '\0') return i;
+  }  
+
+  return -1;
+}
+
+#define MAX_ARGS 8
+
+double builtin_sqrt(double* a) { return sqrt(a[0]); }
+double builtin_sin(double* a)  { return sin(a[0]); }
+double builtin_cos(double* a)  { return cos(a[0]); }
+double builtin_exp(double* a)  { return exp(a[0]); }
+double builtin_log(double* a)  { return log(a[0]); }
+double builtin_abs(double* a)  { return fabs(a[0]); }
+double builtin_min(double* a)  { return fmin(a[0], a[1]); }
+double builtin_max(double* a)  { return fmax(a[0], a[1]); }
+
+typedef struct {
+  char* name;
+  int arity;
+  double (*fn)(double* args);
+} Builtin;
+
+// all builtins are pure
+const Builtin BUILTINS[] = {
+  {"sqrt", 1, builtin_sqrt},
+  {"sin",  1, builtin_sin},
+  {"cos",  1, builtin_cos},
+  {"exp",  1, builtin_exp},
+  {"log",  1, builtin_log},
+  {"abs",  1, builtin_abs},
+  {"min",  2, builtin_min},
+  {"max",  2, builtin_max},
+};
+#define BUILTINS_COUNT (int) (sizeof(BUILTINS) / sizeof(Builtin))
+
+int builtin_find(char* name, int len) {
+  for (int i=0; i<BUILTINS_COUNT; i++) {
+    if (strncmp(BUILTINS[i].name, name, len) == 0 && BUILTINS[i].name[len] == '\0') return i;
+  }  
+
+  return -1;
+}
+
+double eval_nodes(Program* prog, size_t count, Env* env, size_t frame);
+double call_function(Env* env, int callee, Value* args);
+
 typedef enum {
   NoErr = 0,
   BadToken,
@@ -257,16 +616,51 @@ typedef enum {
   BadLeftExpr,
   ExpectAssign,
   ExpectIdentifier,
+  ExpectParen,
+  UnknownFunction,
+  WrongArgCount,
+  DuplicateParam,
 } ParseErr;
 
+typedef enum {
+  OpPrefix,
+  OpInfix,
+  OpParen,
+  OpCall,
+} OpKind;
+
+// pending operator on the parser stack
+typedef struct {
+  OpKind kind;
+  Token* token;
+  int right_lvl;
+  int argc;
+} PendingOp;
+
+VEC_DEF(PendingOp);
+
 typedef struct  {
   char* src;
   TokenVec tokens;
   int curr_token;
   ExprVec ast;
   ParseErr err;
+
+  // explicit stacks used by parse_expr instead of recursion:
+  // pending operators, and the roots of the parsed operands
+  PendingOpVec ops;
+  IndexVec operands;
+
+  Env* env;
+  // parameters of the function being defined, if any
+  Span params[MAX_ARGS];
+  int params_count;
+  // set when the parsed expression reads or writes globals
+  int impure;
 } Parser;
 
+Token end_token = { End, -1, 0, 0 };
+
 void parse_log_err(Parser* p, ParseErr err) {
   p->err = err;
   
@@ -292,13 +686,34 @@ void parse_log_err(Parser* p, ParseErr err) {
       break;
 
     case ExpectIdentifier:
-      fprintf(stderr, "expected identifier token after 'var' keyword");
+      fprintf(stderr, "expected identifier token");
+      break;
+
+    case ExpectParen:
+      fprintf(stderr, "expected '(' token");
+      break;
+
+    case UnknownFunction:
+      fprintf(stderr, "call to undefined function");
+      break;
+
+    case WrongArgCount:
+      fprintf(stderr, "wrong number of arguments");
+      break;
+
+    case DuplicateParam:
+      fprintf(stderr, "duplicate or too many parameters");
       break;
       
     default: break;
   }
   
   int token_id = p->curr_token-1;
+  if ((size_t) token_id >= p->tokens.len) {
+    fprintf(stderr, " at end of input\n");
+    return;
+  }  
+
   Token* t = &p->tokens.data[token_id];
   int column = t->start;
   fprintf(stderr, " at token %d (type = %c), column %d\n", token_id, t->type, column);
@@ -309,11 +724,20 @@ int parser_push(Parser* p, Expr e) {
   return p->ast.len-1;
 }
 
+int parser_is_at_end(Parser* p) {
+  return (size_t) p->curr_token >= p->tokens.len;
+}
+
 Token* parser_eat(Parser* p) {
+  if (parser_is_at_end(p)) {
+    p->curr_token++;
+    return &end_token;
+  }  
   return &p->tokens.data[p->curr_token++];
 }
 
 Token* parser_peek(Parser* p) {
+  if (parser_is_at_end(p)) return &end_token;
   return &p->tokens.data[p->curr_token];
 }
 
@@ -321,13 +745,17 @@ Expr* parser_get(Parser* p, int idx) {
   return &p->ast.data[idx];
 }
 
-int parser_is_at_end(Parser* p) {
-  return (size_t) p->curr_token == p->tokens.len;
-}
-
 void parser_free(Parser *p) {
   VEC_FREE(p->tokens);
   VEC_FREE(p->ast);
+  VEC_FREE(p->ops);
+  VEC_FREE(p->operands);
+}
+
+Program program_from_parser(Parser* p) {
+  Program prog = { strdup(p->src), p->ast };
+  p->ast = (ExprVec) {0};
+  return prog;
 }
 
 typedef struct {
@@ -336,9 +764,11 @@ typedef struct {
 } PrecLvl;
 #define PREC(_a, _b) (PrecLvl) {(_a), (_b)}
 
+// a pending operator is reduced when its right level is higher than
+// the left level of the next one: left < right makes it left associative
 PrecLvl prefix_lvl(Token* op) {
   switch (op->type) {
-    case Sub: return PREC(0, 15);
+    case Sub: return PREC(0, 17);
     default: return PREC(-1,-1);
   }
 }
@@ -347,14 +777,14 @@ PrecLvl infix_lvl(Token* op) {
   switch (op->type) {
     case Add:
     case Sub:
-      return PREC(9,9);
+      return PREC(9,10);
     case Mul:
     case Div:
-      return PREC(10,10);
-    case Exp:
       return PREC(11,12);
+    case Exp:
+      return PREC(14,13);
     case Rem: 
-      return PREC(14,14);
+      return PREC(15,16);
 
     default: return PREC(-1,-1);
   }
@@ -366,59 +796,278 @@ PrecLvl postfix_lvl(Token* op) {
   }  
 }
 
-int parse_expr(Parser* p, int prec_lvl) {
-  Token* t = parser_eat(p);
+double apply_unary(TokenType op, double rhs) {
+  switch(op) {
+    case Sub: return -rhs;
+    default: return NAN;
+  }  
+}
 
-  // parse lhs
-  int lhs;
-  switch (t->type) {
-    case Number:
-      lhs = parser_push(p, literal(t->val));
-      break;
+double apply_binary(TokenType op, double lhs, double rhs) {
+  switch(op) {
+    case Add: return lhs + rhs;
+    case Sub: return lhs - rhs;
+    case Mul: return lhs * rhs;
+    case Div: return lhs / rhs;
+    case Rem: return fmod(lhs, rhs);
+    case Exp: return pow(lhs, rhs);
+    default: return NAN;
+  }  
+}
 
-    case Identifier:
-      lhs = parser_push(p, variable(t));
-      break;
+int parser_is_literal(Parser* p, int idx) {
+  return parser_get(p, idx)->type == Literal;
+}
 
-    case Sub:
-      PrecLvl lvl = prefix_lvl(t);
-      int rhs = parse_expr(p, lvl.right);
-      lhs = parser_push(p, unary(t, rhs));
+// replaces an operation on literal operands with its result.
+// operands are the last nodes pushed, so they're popped off the ast
+int parser_push_folded(Parser* p, Expr e) {
+  if (p->env->no_fold) return parser_push(p, e);
+
+  switch (e.type) {
+    case Unary:
+      if (parser_is_literal(p, e.un.expr)) {
+        double val = apply_unary(e.un.op, parser_get(p, e.un.expr)->val);
+        p->ast.len -= 1;
+        return parser_push(p, literal(val));
+      }
       break;
 
-    case ParenLeft:
-      lhs = parse_expr(p, 0);
-      if (parser_eat(p)->type != ParenRight) {
-        parse_log_err(p, UnclosedParen);
-        return -1;
+    case Binary: 
+      if (parser_is_literal(p, e.bin.lhs_idx) && parser_is_literal(p, e.bin.rhs_idx)) {
+        double lhs = parser_get(p, e.bin.lhs_idx)->val;
+        double rhs = parser_get(p, e.bin.rhs_idx)->val;
+        p->ast.len -= 2;
+        return parser_push(p, literal(apply_binary(e.bin.op, lhs, rhs)));
       }
       break;
 
+    default: break; 
+  }  
+
+  return parser_push(p, e);
+}
+
+// builds the call node from the argc operands on top of the stack
+int parser_push_call(Parser* p, Token* name, int argc) {
+  char* fname = p->src + name->start;
+  ExprType type;
+  int callee, arity, pure;
+
+  if ((callee = env_find_func(p->env, fname, name->len)) != -1) {
+    FuncDef* f = &p->env->funcs.data[callee];
+    type = FnCall;
+    arity = f->arity;
+    pure = f->pure;
+  } else if ((callee = builtin_find(fname, name->len)) != -1) {
+    type = BuiltinCall;
+    arity = BUILTINS[callee].arity;
+    pure = 1;
+  } else {
+    parse_log_err(p, UnknownFunction);
+    return -1;
+  }  
+
+  if (argc != arity) {
+    parse_log_err(p, WrongArgCount);
+    return -1;
+  }  
+
+  if (!pure) p->impure = 1;
+
+  Index* args = &p->operands.data[p->operands.len - argc];
+  int all_literals = 1;
+  for (int i=0; i<argc; i++) all_literals &= parser_is_literal(p, args[i]);
+  p->operands.len -= argc;
+
+  // constant folding: every argument is a single literal node,
+  // so they are the last argc nodes in the ast
+  if (pure && all_literals && !p->env->no_fold) {
+    Value vals[MAX_ARGS];
+    for (int i=0; i<argc; i++) vals[i] = parser_get(p, args[i])->val;
+    p->ast.len -= argc;
+
+    double res;
+    if (type == BuiltinCall) {
+      res = BUILTINS[callee].fn(vals);
+    } else {
+      res = call_function(p->env, callee, vals);
+    }
+    return parser_push(p, literal(res));
+  }  
+
+  return parser_push(p, call(type, callee, argc));
+}
+
+int parser_find_param(Parser* p, Token* t) {
+  for (int i=0; i<p->params_count; i++) {
+    Span param = p->params[i];
+    if (param.len == t->len && strncmp(p->src + param.start, p->src + t->start, t->len) == 0) return i;
+  }  
+
+  return -1;
+}
+
+// pops the operator on top of the stack and its operands,
+// and pushes the resulting expression as a new operand
+int parser_reduce(Parser* p) {
+  PendingOp op = p->ops.data[--p->ops.len];
+  int res;
+
+  switch (op.kind) {
+    case OpPrefix: {
+      int rhs = p->operands.data[--p->operands.len];
+      res = parser_push_folded(p, unary(op.token, rhs));
+    } break;
+
+    case OpInfix: {
+      int rhs = p->operands.data[--p->operands.len];
+      int lhs = p->operands.data[--p->operands.len];
+      res = parser_push_folded(p, binary(lhs, op.token, rhs));
+    } break;
+
+    case OpCall:
+      res = parser_push_call(p, op.token, op.argc);
+      if (res == -1) return -1;
+      break;
+
     default:
-      parse_log_err(p, BadLeftExpr);
-      return -1;
+      // parens are never reduced, they're just popped
+      return 0;
+  }
+
+  VEC_PUSH(p->operands, res);
+  return 0;
+}
+
+// reduces every operator that binds tighter than lvl,
+// stopping at parens and calls
+int parser_reduce_until(Parser* p, int lvl) {
+  while (p->ops.len > 0) {
+    PendingOp* top = &p->ops.data[p->ops.len-1];
+    if (top->kind == OpParen || top->kind == OpCall) break;
+    if (top->right_lvl <= lvl) break;
+    if (parser_reduce(p) == -1) return -1;
   }
 
+  return 0;
+}
+
+// shunting yard: operands go straight to the ast (which is why it ends up
+// in post order), operators wait on the stack until something with
+// lower precedence, a closing paren or the end of the input comes
+int parse_expr(Parser* p) {
+  p->ops.len = 0;
+  p->operands.len = 0;
+  int expect_operand = 1;
+
   while (1) {
+    Token* t = parser_peek(p);
+
+    if (expect_operand) {
+      parser_eat(p);
+
+      switch (t->type) {
+        case Number:
+          VEC_PUSH(p->operands, parser_push(p, literal(t->val)));
+          expect_operand = 0;
+          break;
+
+        case Identifier: {
+          if (parser_peek(p)->type == ParenLeft) {
+            parser_eat(p);
+
+            if (parser_peek(p)->type == ParenRight) {
+              parser_eat(p);
+              int res = parser_push_call(p, t, 0);
+              if (res == -1) return -1;
+              VEC_PUSH(p->operands, res);
+              expect_operand = 0;
+            } else {
+              PendingOp op = { OpCall, t, 0, 0 };
+              VEC_PUSH(p->ops, op);
+            }
+            break;
+          }
+
+          int slot = parser_find_param(p, t);
+          if (slot != -1) {
+            VEC_PUSH(p->operands, parser_push(p, param(slot)));
+          } else {
+            p->impure = 1;
+            VEC_PUSH(p->operands, parser_push(p, variable(t)));
+          }
+          expect_operand = 0;
+        } break;
+
+        case Sub: {
+          PendingOp op = { OpPrefix, t, prefix_lvl(t).right, 0 };
+          VEC_PUSH(p->ops, op);
+        } break;
+
+        case ParenLeft: {
+          PendingOp op = { OpParen, t, 0, 0 };
+          VEC_PUSH(p->ops, op);
+        } break;
+
+        default:
+          parse_log_err(p, BadLeftExpr);
+          return -1;
+      }
+
+      continue;
+    }
+
     if (parser_is_at_end(p)) break;
 
-    Token* op = parser_peek(p);
-    if (token_is_not_op(op)) {
+    if (token_is_not_op(t)) {
+      parser_eat(p);
       parse_log_err(p, ExpectOperator);
       return -1;
     }
 
     // postfix operator goes there
 
-    PrecLvl lvl = infix_lvl(op);
-    if (lvl.left < prec_lvl) break;
+    if (t->type == ParenRight || t->type == Comma) {
+      if (parser_reduce_until(p, -1) == -1) return -1;
+      // nothing to close, leave it to the caller
+      if (p->ops.len == 0) break;
+      parser_eat(p);
+
+      PendingOp* top = &p->ops.data[p->ops.len-1];
+      if (t->type == Comma) {
+        if (top->kind != OpCall || top->argc == MAX_ARGS-1) {
+          parse_log_err(p, top->kind != OpCall ? ExpectOperator : WrongArgCount);
+          return -1;
+        }
+        top->argc++;
+        expect_operand = 1;
+      } else if (top->kind == OpCall) {
+        top->argc++;
+        if (parser_reduce(p) == -1) return -1;
+      } else {
+        p->ops.len--;
+      }
+      continue;
+    }
+
+    PrecLvl lvl = infix_lvl(t);
+    if (lvl.left < 0) break;
     parser_eat(p);
 
-    int rhs = parse_expr(p, lvl.right);
-    lhs = parser_push(p, binary(lhs, op, rhs));
+    if (parser_reduce_until(p, lvl.left) == -1) return -1;
+    PendingOp op = { OpInfix, t, lvl.right, 0 };
+    VEC_PUSH(p->ops, op);
+    expect_operand = 1;
   }
 
-  return lhs;
+  if (parser_reduce_until(p, -1) == -1) return -1;
+  if (p->ops.len > 0) {
+    parse_log_err(p, UnclosedParen);
+    return -1;
+  }
+
+  return p->operands.data[0];
 }
 
 int parse_assign(Parser* p) {
@@ -436,14 +1085,65 @@ int parse_assign(Parser* p) {
     return -1;
   }
 
-  int rhs = parse_expr(p, 0);
+  int rhs = parse_expr(p);
+  if (rhs == -1) return -1;
   return parser_push(p, var_assign(name, rhs));
 }
 
-Parser parse(char* str) {
+// fn name(a, b, ...) = body
+// returns the name token, the parameters are left in the parser
+Token* parse_fn_header(Parser* p) {
+  // eat fn keyword
+  parser_eat(p);
+
+  Token* name = parser_eat(p);
+  if (name->type != Identifier) {
+    parse_log_err(p, ExpectIdentifier);
+    return NULL;
+  }  
+
+  if (parser_eat(p)->type != ParenLeft) {
+    parse_log_err(p, ExpectParen);
+    return NULL;
+  }  
+
+  if (parser_peek(p)->type != ParenRight) {
+    while (1) {
+      Token* param = parser_eat(p);
+      if (param->type != Identifier) {
+        parse_log_err(p, ExpectIdentifier);
+        return NULL;
+      }
+
+      if (p->params_count == MAX_ARGS || parser_find_param(p, param) != -1) {
+        parse_log_err(p, DuplicateParam);
+        return NULL;
+      }
+      p->params[p->params_count++] = (Span) {param->start, param->len};
+
+      if (parser_peek(p)->type != Comma) break;
+      parser_eat(p);
+    }
+  }  
+
+  if (parser_eat(p)->type != ParenRight) {
+    parse_log_err(p, UnclosedParen);
+    return NULL;
+  }  
+
+  if (parser_eat(p)->type != Assign) {
+    parse_log_err(p, ExpectAssign);
+    return NULL;
+  }  
+
+  return name;
+}
+
+Parser parser_new(char* str, Env* env) {
   TokenVec tokens = tokenize(str);
   Parser p = {0};
   p.src = str;
+  p.env = env;
   
   if (tokens.len == 0) {
     p.err = BadToken;
@@ -451,136 +1151,727 @@ Parser parse(char* str) {
   }
   
   p.tokens = tokens;
+  return p;
+}
+
+Parser parse(char* str, Env* env) {
+  Parser p = parser_new(str, env);
+  if (p.err != NoErr) return p;
 
   if (parser_peek(&p)->type == Var) {
     parse_assign(&p);
   } else {
-    parse_expr(&p, 0);
+    parse_expr(&p);
   }
 
   return p;
 }
 
-typedef struct {
-  char* name;
-  double val;
-} VarEntry;
+int is_fn_definition(char* str) {
+  while (isspace(*str)) str++;
+  return strncmp(str, "fn", 2) == 0 && !isalnum(str[2]) && str[2] != '_';
+}
 
-VEC_DEF(VarEntry);
+// parses and registers a function definition.
+// returns the index of the new function, or -1 on error
+int define_function(Env* env, char* str) {
+  Parser p = parser_new(str, env);
+  if (p.err != NoErr) return -1;
 
-double eval_rec(Parser* p, int root, VarEntryVec* ctx) {
-  Expr* e = parser_get(p, root);
+  Token* name = parse_fn_header(&p);
+  if (name == NULL || parse_expr(&p) == -1 || p.err != NoErr) {
+    parser_free(&p);
+    return -1;
+  }  
 
-  switch (e->type) {
-    case Literal: {
-      return e->val;
+  FuncDef f = {
+    strndup(str + name->start, name->len),
+    p.params_count,
+    !p.impure,
+    program_from_parser(&p),
+  };
+  VEC_PUSH(env->funcs, f);
+
+  parser_free(&p);
+  return env->funcs.len-1;
+}
+
+int env_get_var(Env* env, char* src, Span name) {
+  int idx = env_find_var(env, src + name.start, name.len);
+  if (idx == -1) idx = env_add_var(env, src + name.start, name.len);
+  return idx;
+}
+
+// collects the globals read by an expression, including those read
+// by the bodies of the functions it calls
+void collect_deps(Env* env, Program* prog, IndexVec* deps) {
+  for (size_t i=0; i<prog->ast.len; i++) {
+    Expr* e = &prog->ast.data[i];
+
+    if (e->type == Variable) {
+      int var = env_get_var(env, prog->src, e->var_name);
+
+      int present = 0;
+      for (size_t j=0; j<deps->len; j++) present |= deps->data[j] == var;
+      if (!present) VEC_PUSH(*deps, var);
+    } else if (e->type == FnCall) {
+      FuncDef* f = &env->funcs.data[e->call.callee];
+      if (!f->pure) collect_deps(env, &f->body, deps);
     }
+  }
+}
 
-    case Variable: {
-      int start = e->var_tok->start;
-      int len = e->var_tok->len;
+// fills env->order with root and every variable that reads it, directly
+// or not, in topological order (reverse dfs post order). the visited
+// variables are marked with the current env->mark
+void env_downstream(Env* env, int root) {
+  env->mark++;
+  env->order.len = 0;
+  env->visits.len = 0;
+
+  env->vars.data[root].mark = env->mark;
+  VEC_PUSH(env->visits, ((Visit) {root, 0}));
+
+  while (env->visits.len > 0) {
+    Visit* top = &env->visits.data[env->visits.len-1];
+    VarEntry* var = &env->vars.data[top->var];
+
+    if (top->edge == var->users.len) {
+      VEC_PUSH(env->order, top->var);
+      env->visits.len--;
+      continue;
+    }
 
-      char* name = strndup(p->src + start, len);
+    int next = var->users.data[top->edge++];
+    if (env->vars.data[next].mark != env->mark) {
+      env->vars.data[next].mark = env->mark;
+      VEC_PUSH(env->visits, ((Visit) {next, 0}));
+    }
+  }
 
-      int present = -1;
-      for (size_t i=0; i<ctx->len; i++) {
-        if (strcmp(ctx->data[i].name, name) == 0) {
-          present = i;
-          break;
-        }
-      }
+  // reverse post order
+  for (size_t i=0, j=env->order.len-1; i<j; i++, j--) {
+    Index tmp = env->order.data[i];
+    env->order.data[i] = env->order.data[j];
+    env->order.data[j] = tmp;
+  }
+}
 
-      if (present == -1) {
-        fprintf(stderr, "[EVAL ERR] Undefined variable at expr id %d\n", root); 
-        return NAN;
-      } else {
-        return ctx->data[present].val;
-      }
+void index_remove(IndexVec* vec, Index val) {
+  for (size_t i=0; i<vec->len; i++) {
+    if (vec->data[i] == val) {
+      vec->data[i] = vec->data[--vec->len];
+      return;
     }
+  }
+}
 
-    case VarAssign: {
-      int start = e->var.token->start;
-      int len = e->var.token->len;
+double var_recompute(Env* env, int idx) {
+  VarEntry* var = &env->vars.data[idx];
+  Program* formula = &var->formula;
+
+  // the assignment is the last node, everything before it is the rhs
+  double val = eval_nodes(formula, formula->ast.len-1, env, 0);
+  // eval may have added variables and moved the vector
+  var = &env->vars.data[idx];
+  var->val = val;
+  var->defined = 1;
+  return val;
+}
 
-      char* name = strndup(p->src + start, len);
-      double val = eval_rec(p, e->var.rhs_idx, ctx);
-      VarEntry e = { name, val };
+// stores the assignment as the variable formula, rewires the dependency
+// graph and recomputes the variables downstream of the assigned one.
+// an assignment that would make the variable depend on itself is rejected
+double reactive_assign(Program* prog, int root, Env* env) {
+  Expr* e = &prog->ast.data[root];
+  int x = env_get_var(env, prog->src, e->var.name);
+
+  IndexVec deps = {0};
+  collect_deps(env, prog, &deps);
+
+  // everything downstream of x reads it, so none of them can be read by x
+  env_downstream(env, x);
+  for (size_t i=0; i<deps.len; i++) {
+    if (env->vars.data[deps.data[i]].mark == env->mark) {
+      fprintf(stderr, "[EVAL ERR] Cyclic definition of variable %s\n", env->vars.data[x].name);
+      VEC_FREE(deps);
+      return NAN;
+    }
+  }
 
-      int present = -1;
-      for (size_t i=0; i<ctx->len; i++) {
-        if (strcmp(ctx->data[i].name, name) == 0) {
-          present = i;
-          break;
+  VarEntry* var = &env->vars.data[x];
+  for (size_t i=0; i<var->deps.len; i++) {
+    index_remove(&env->vars.data[var->deps.data[i]].users, x);
+  }
+  VEC_FREE(var->deps);
+  var->deps = deps;
+  for (size_t i=0; i<deps.len; i++) {
+    VEC_PUSH(env->vars.data[deps.data[i]].users, x);
+  }
+
+  if (var->has_formula) program_free(&var->formula);
+  var->formula = program_clone(prog);
+  var->has_formula = 1;
+
+  // order[0] is x itself
+  for (size_t i=0; i<env->order.len; i++) {
+    var_recompute(env, env->order.data[i]);
+  }
+
+  return env->vars.data[x].val;
+}
+
+void env_reserve_stack(Env* env, size_t cap) {
+  if (env->stack.cap < cap) {
+    env->stack.cap = cap < 16 ? 16 : cap * 2;
+    env->stack.data = realloc(env->stack.data, env->stack.cap * sizeof(Value));
+  }
+}
+
+// evaluates the first count nodes of the program in a single pass:
+// every node pops its operands from the value stack and pushes its result.
+// frame is the stack index of the arguments of the function being run
+double eval_nodes(Program* prog, size_t count, Env* env, size_t frame) {
+  size_t base = env->stack.len;
+  size_t top = base;
+  // a node pushes at most one value
+  env_reserve_stack(env, base + count);
+  Value* stack = env->stack.data;
+
+  for (size_t i=0; i<count; i++) {
+    Expr* e = &prog->ast.data[i];
+
+    switch (e->type) {
+      case Literal: {
+        stack[top++] = e->val;
+      } break;
+
+      case Param: {
+        stack[top++] = stack[frame + e->slot];
+      } break;
+
+      case Variable: {
+        int present = env_find_var(env, prog->src + e->var_name.start, e->var_name.len);
+
+        if (present == -1 || !env->vars.data[present].defined) {
+          fprintf(stderr, "[EVAL ERR] Undefined variable at expr id %zu\n", i); 
+          stack[top++] = NAN;
+        } else {
+          stack[top++] = env->vars.data[present].val;
         }
-      }
+      } break;
 
-      if (present == -1) {
-        VEC_PUSH(*ctx, e);
-      } else {
-        free(ctx->data[present].name);
-        ctx->data[present] = e;
-      }
+      case VarAssign: {
+        // the value stays on the stack as the result
+        int present = env_get_var(env, prog->src, e->var.name);
+        env->vars.data[present].val = stack[top-1];
+        env->vars.data[present].defined = 1;
+      } break;
+
+      case Unary: {
+        switch(e->un.op) {
+          case Sub: stack[top-1] = -stack[top-1]; break;
+          default:
+            fprintf(stderr, "[EVAL ERR] Invalid unary operator at expr id %zu\n", i); 
+            stack[top-1] = NAN;
+        }
+      } break;
 
-      return val;
+      case Binary: {
+        double rhs = stack[--top];
+        double lhs = stack[top-1];
+        double res;
+
+        switch(e->bin.op) {
+          case Add: res = lhs + rhs; break;
+          case Sub: res = lhs - rhs; break;
+          case Mul: res = lhs * rhs; break;
+          case Div: res = lhs / rhs; break;
+          case Rem: res = fmod(lhs, rhs); break;
+          case Exp: res = pow(lhs, rhs); break;
+          default:
+            fprintf(stderr, "[EVAL ERR] Invalid binary operator at expr id %zu\n", i); 
+            res = NAN;
+        }
+        stack[top-1] = res;
+      } break;
+
+      case BuiltinCall: {
+        // the arguments are already contiguous on the stack
+        top -= e->call.argc;
+        stack[top] = BUILTINS[e->call.callee].fn(&stack[top]);
+        top++;
+      } break;
+
+      case FnCall: {
+        // the arguments become the callee frame,
+        // its own values are pushed right above them
+        Program* body = &env->funcs.data[e->call.callee].body;
+        env->stack.len = top;
+        double res = eval_nodes(body, body->ast.len, env, top - e->call.argc);
+        stack = env->stack.data;
+        top -= e->call.argc;
+        stack[top++] = res;
+      } break;
     }
+  }
 
-    case Unary: {
-      double rhs = eval_rec(p, e->un.expr, ctx);
+  env->stack.len = base;
+  return top > base ? stack[top-1] : NAN;
+}
 
-      switch(e->un.op) {
-        case Sub: return -rhs;
-        default:
-          fprintf(stderr, "[EVAL ERR] Invalid unary operator at expr id %d\n", root); 
-          return NAN;
+double call_function(Env* env, int callee, Value* args) {
+  FuncDef* f = &env->funcs.data[callee];
+  size_t frame = env->stack.len;
+  for (int i=0; i<f->arity; i++) VEC_PUSH(env->stack, args[i]);
+
+  double res = eval_nodes(&f->body, f->body.ast.len, env, frame);
+  env->stack.len = frame;
+  return res;
+}
+
+double eval(Program* prog, Env* env) {
+  // an assignment is always the last node. in reactive mode its rhs is
+  // evaluated once, by the recompute of the assigned variable
+  size_t last = prog->ast.len-1;
+  if (env->reactive && prog->ast.len > 0 && prog->ast.data[last].type == VarAssign) {
+    return reactive_assign(prog, last, env);
+  }
+  return eval_nodes(prog, prog->ast.len, env, 0);
+}
+
+// LRU cache of compiled programs, keyed by their normalized source.
+// entries live in a fixed array; they are chained in the hash buckets
+// and in a doubly linked list ordered by last use (head = most recent).
+typedef struct {
+  Program prog;
+  size_t hash;
+  int hash_next;
+  int prev, next;
+} CacheEntry;
+
+typedef struct {
+  CacheEntry* entries;
+  int* buckets;
+  int cap, len, bucket_count;
+  int head, tail;
+
+  // scratch buffer for the normalized lookup key
+  char* key;
+  size_t key_cap;
+
+  size_t hits, misses, evictions;
+} ProgramCache;
+
+ProgramCache cache_new(int cap) {
+  ProgramCache c = {0};
+  c.cap = cap;
+  c.entries = malloc(cap * sizeof(CacheEntry));
+
+  c.bucket_count = 16;
+  while (c.bucket_count < cap * 2) c.bucket_count *= 2;
+  c.buckets = malloc(c.bucket_count * sizeof(int));
+  for (int i=0; i<c.bucket_count; i++) c.buckets[i] = -1;
+
+  c.head = c.tail = -1;
+  return c;
+}
+
+// drops every entry, keeping the stats
+void cache_clear(ProgramCache* c) {
+  for (int i=0; i<c->len; i++) program_free(&c->entries[i].prog);
+  for (int i=0; i<c->bucket_count; i++) c->buckets[i] = -1;
+  c->len = 0;
+  c->head = c->tail = -1;
+}
+
+void cache_free(ProgramCache* c) {
+  cache_clear(c);
+  free(c->entries);
+  free(c->buckets);
+  free(c->key);
+}
+
+int is_word_char(char c) {
+  return isalnum(c) || c == '_' || c == '.';
+}
+
+// drops all whitespace, except a single space between two words
+// (as in "var x"), so that "x*2" and " x *  2\n" share the same entry
+char* cache_normalize(ProgramCache* c, char* str) {
+  size_t len = strlen(str);
+  if (len + 1 > c->key_cap) {
+    c->key_cap = len + 1;
+    c->key = realloc(c->key, c->key_cap);
+  }
+
+  size_t count = 0;
+  int pending_space = 0;
+  for (; *str != '\0'; str++) {
+    if (isspace(*str)) {
+      pending_space = count > 0;
+    } else {
+      if (pending_space && is_word_char(c->key[count-1]) && is_word_char(*str)) {
+        c->key[count++] = ' ';
       }
+      pending_space = 0;
+      c->key[count++] = *str;
     }
-    case Binary: {
-      double lhs = eval_rec(p, e->bin.lhs_idx, ctx);
-      double rhs = eval_rec(p, e->bin.rhs_idx, ctx);
-
-      switch(e->bin.op) {
-        case Add: return lhs + rhs;
-        case Sub: return lhs - rhs;
-        case Mul: return lhs * rhs;
-        case Div: return lhs / rhs;
-        case Rem: return fmod(lhs, rhs);
-        case Exp: return pow(lhs, rhs);
-        default:
-          fprintf(stderr, "[EVAL ERR] Invalid binary operator at expr id %d\n", root); 
-          return NAN;
+  }
+
+  c->key[count] = '\0';
+  return c->key;
+}
+
+size_t cache_hash(char* str) {
+  return hash_bytes(str, strlen(str));
+}
+
+void cache_lru_unlink(ProgramCache* c, int idx) {
+  CacheEntry* e = &c->entries[idx];
+  if (e->prev != -1) c->entries[e->prev].next = e->next;
+  else c->head = e->next;
+  if (e->next != -1) c->entries[e->next].prev = e->prev;
+  else c->tail = e->prev;
+}
+
+void cache_lru_push_front(ProgramCache* c, int idx) {
+  CacheEntry* e = &c->entries[idx];
+  e->prev = -1;
+  e->next = c->head;
+  if (c->head != -1) c->entries[c->head].prev = idx;
+  c->head = idx;
+  if (c->tail == -1) c->tail = idx;
+}
+
+void cache_bucket_remove(ProgramCache* c, int idx) {
+  int* link = &c->buckets[c->entries[idx].hash & (c->bucket_count-1)];
+  while (*link != idx) link = &c->entries[*link].hash_next;
+  *link = c->entries[idx].hash_next;
+}
+
+// returns the compiled program for str, parsing it only on a miss.
+// returns NULL if the source doesn't parse; failures aren't cached.
+Program* cache_get(ProgramCache* c, char* str, Env* env) {
+  char* key = cache_normalize(c, str);
+  size_t hash = cache_hash(key);
+  int bucket = hash & (c->bucket_count-1);
+
+  for (int i = c->buckets[bucket]; i != -1; i = c->entries[i].hash_next) {
+    CacheEntry* e = &c->entries[i];
+    if (e->hash == hash && strcmp(e->prog.src, key) == 0) {
+      c->hits++;
+      if (c->head != i) {
+        cache_lru_unlink(c, i);
+        cache_lru_push_front(c, i);
       }
+      return &e->prog;
+    }
+  }
+
+  c->misses++;
+  Parser parser = parse(key, env);
+  if (parser.err != NoErr) {
+    parser_free(&parser);
+    return NULL;
+  }
+
+  int idx;
+  if (c->len < c->cap) {
+    idx = c->len++;
+  } else {
+    // reuse the least recently used slot
+    idx = c->tail;
+    cache_lru_unlink(c, idx);
+    cache_bucket_remove(c, idx);
+    program_free(&c->entries[idx].prog);
+    c->evictions++;
+  }
+
+  CacheEntry* e = &c->entries[idx];
+  e->prog = program_from_parser(&parser);
+  e->hash = hash;
+  e->hash_next = c->buckets[bucket];
+  c->buckets[bucket] = idx;
+  cache_lru_push_front(c, idx);
+
+  parser_free(&parser);
+  return &e->prog;
+}
+
+void cache_print_stats(ProgramCache* c) {
+  size_t lookups = c->hits + c->misses;
+  printf("Cache: %d/%d entries, %zu hits, %zu misses, %zu evictions (hit rate %.1f%%)\n",
+    c->len, c->cap, c->hits, c->misses, c->evictions,
+    lookups == 0 ? 0.0 : 100.0 * c->hits / lookups);
+}
+
+double time_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// measures the cost of a call against the same expression inlined
+int bench_calls() {
+  #define BENCH_ITERS 2000000
+  Env env = {0};
+  define_function(&env, "fn sq(x) = x*x");
+  define_function(&env, "fn hyp(a, b) = sqrt(sq(a) + sq(b))");
+
+  char* cases[] = {
+    "x*x",
+    "sq(x)",
+    "sqrt(x)",
+    "sqrt(x*x + x*x)",
+    "hyp(x, x)",
+    "hyp(3, 4)",
+  };
+
+  Parser setup = parse("var x = 0", &env);
+  Program assign = program_from_parser(&setup);
+  parser_free(&setup);
+  eval(&assign, &env);
+  program_free(&assign);
+
+  for (size_t i=0; i<sizeof(cases)/sizeof(char*); i++) {
+    Parser p = parse(cases[i], &env);
+    Program prog = program_from_parser(&p);
+    parser_free(&p);
+
+    double sum = 0;
+    double start = time_now_ns();
+    for (int n=0; n<BENCH_ITERS; n++) {
+      env.vars.data[0].val = n;
+      sum += eval(&prog, &env);
     }
+    double elapsed = time_now_ns() - start;
+
+    printf("%-18s %3zu nodes  %7.2f ns/eval  (checksum %g)\n",
+      cases[i], prog.ast.len, elapsed / BENCH_ITERS, sum);
+    program_free(&prog);
+  }  
+
+  env_free(&env);
+  return 0;
+}
+
+double bench_assign(Env* env, char* src) {
+  Parser p = parse(src, env);
+  Program prog = program_from_parser(&p);
+  parser_free(&p);
+  double val = eval(&prog, env);
+  program_free(&prog);
+  return val;
+}
+
+// builds a graph of reactive variables, where each one reads its
+// predecessor and its parent in a binary tree, then updates a few inputs
+int bench_reactive() {
+  #define GRAPH_SIZE 100000
+  Env env = {0};
+  env.reactive = 1;
+  char buf[128];
+
+  double start = time_now_ns();
+  bench_assign(&env, "var v0 = 1");
+  for (int i=1; i<GRAPH_SIZE; i++) {
+    snprintf(buf, sizeof(buf), "var v%d = v%d + v%d / 2", i, i-1, (i-1)/2);
+    bench_assign(&env, buf);
+  }
+  printf("build %d vars: %.2f ms\n", GRAPH_SIZE, (time_now_ns() - start) / 1e6);
+
+  int inputs[] = { 0, GRAPH_SIZE/2, GRAPH_SIZE-10 };
+  for (size_t i=0; i<sizeof(inputs)/sizeof(int); i++) {
+    snprintf(buf, sizeof(buf), "var v%d = 2", inputs[i]);
+    start = time_now_ns();
+    bench_assign(&env, buf);
+    double elapsed = time_now_ns() - start;
+    printf("update v%-6d %6zu recomputed  %8.2f ms\n", inputs[i], env.order.len, elapsed / 1e6);
   }
 
-  // unreachable
-  return NAN;
+  snprintf(buf, sizeof(buf), "var v0 = v%d", GRAPH_SIZE-1);
+  start = time_now_ns();
+  bench_assign(&env, buf);
+  printf("cycle check:  %8.2f ms\n", (time_now_ns() - start) / 1e6);
+
+  env_free(&env);
+  return 0;
 }
 
-double eval(Parser* p, VarEntryVec* ctx) {
-  return eval_rec(p, p->ast.len-1, ctx);
+// writes prefix n times, then x, then suffix n times
+char* stress_gen(char* prefix, char* suffix, int n) {
+  size_t plen = strlen(prefix), slen = strlen(suffix);
+  char* buf = malloc(n * (plen + slen) + 2);
+  char* c = buf;
+
+  for (int i=0; i<n; i++, c += plen) memcpy(c, prefix, plen);
+  *c++ = 'x';
+  for (int i=0; i<n; i++, c += slen) memcpy(c, suffix, slen);
+  *c = '\0';
+  return buf;
 }
 
-int main() {
+// parses and evaluates machine generated expressions far deeper
+// than the C stack would allow with a recursive parser
+int stress() {
+  #define STRESS_DEPTH 1000000
+  Env env = {0};
+  Parser setup = parse("var x = 1", &env);
+  Program assign = program_from_parser(&setup);
+  parser_free(&setup);
+  eval(&assign, &env);
+  program_free(&assign);
+
+  struct {
+    char* prefix;
+    char* suffix;
+    double expected;
+  } cases[] = {
+    { "-(", ")", STRESS_DEPTH % 2 == 0 ? 1 : -1 },
+    { "(", ")", 1 },
+    { "x+", "", STRESS_DEPTH + 1 },
+    { "x+(", ")", STRESS_DEPTH + 1 },
+    { "x*", "+1", STRESS_DEPTH + 1 },
+    { "x^", "", 1 },
+    { "abs(", ")", 1 },
+    { "1+", "", STRESS_DEPTH + 1 },
+  };
+
+  int failed = 0;
+  for (size_t i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+    char* src = stress_gen(cases[i].prefix, cases[i].suffix, STRESS_DEPTH);
+
+    double start = time_now_ns();
+    Parser p = parse(src, &env);
+    double parsed = time_now_ns();
+    if (p.err != NoErr) {
+      printf("%-6s ... x ... %-4s parse error\n", cases[i].prefix, cases[i].suffix);
+      failed = 1;
+      parser_free(&p);
+      free(src);
+      continue;
+    }
+
+    Program prog = program_from_parser(&p);
+    parser_free(&p);
+
+    double eval_start = time_now_ns();
+    double res = eval(&prog, &env);
+    double evaluated = time_now_ns();
+
+    int ok = res == cases[i].expected;
+    failed |= !ok;
+    printf("%-6s ... x ... %-4s %8zu nodes  parse %7.2f ms  eval %6.2f ns/node  %s\n",
+      cases[i].prefix, cases[i].suffix, prog.ast.len,
+      (parsed - start) / 1e6, (evaluated - eval_start) / prog.ast.len,
+      ok ? "ok" : "WRONG RESULT");
+
+    program_free(&prog);
+    free(src);
+  }
+
+  env_free(&env);
+  return failed;
+}
+
+// lexes a generated, number dense input and checks every literal
+// against strtod, then times the old strndup + atof path on the same spans
+int bench_lex() {
+  #define LEX_NUMBERS 1000000
+  char* buf = malloc(LEX_NUMBERS * 32);
+  char* c = buf;
+  srand(42);
+
+  for (int i=0; i<LEX_NUMBERS; i++) {
+    if (i > 0) *c++ = '+';
+    switch (i % 6) {
+      case 0: c += sprintf(c, "%d", rand() % 1000); break;
+      case 1: c += sprintf(c, "%d.%d", rand() % 100000, rand() % 1000); break;
+      case 2: c += sprintf(c, "%d.%de-%d", rand() % 10, rand() % 100000, rand() % 30); break;
+      case 3: c += sprintf(c, "0x%X", rand()); break;
+      case 4: c += sprintf(c, "%.17g", (double) rand() / RAND_MAX); break;
+      case 5: c += sprintf(c, "%d%d%de%d", rand(), rand(), rand(), rand() % 300); break;
+    }
+  }
+  *c = '\0';
+  size_t size = c - buf;
+
+  double start = time_now_ns();
+  TokenVec tokens = tokenize(buf);
+  double elapsed = time_now_ns() - start;
+
+  size_t mismatches = 0;
+  for (size_t i=0; i<tokens.len; i++) {
+    Token* t = &tokens.data[i];
+    if (t->type == Number && t->val != strtod(buf + t->start, NULL)) mismatches++;
+  }
+
+  printf("tokenize:     %zu tokens, %.2f MB in %.2f ms  (%.1f Mtokens/s, %.0f MB/s)\n",
+    tokens.len, size / 1e6, elapsed / 1e6, tokens.len / elapsed * 1e3, size / elapsed * 1e3);
+  printf("mismatches against strtod: %zu\n", mismatches);
+
+  start = time_now_ns();
+  double sum = 0;
+  for (size_t i=0; i<tokens.len; i++) {
+    Token* t = &tokens.data[i];
+    if (t->type != Number) continue;
+    char* num = strndup(buf + t->start, t->len);
+    sum += atof(num);
+    free(num);
+  }
+  elapsed = time_now_ns() - start;
+  printf("strndup+atof: %.2f ms for the numbers alone  (checksum %g)\n", elapsed / 1e6, sum);
+
+  VEC_FREE(tokens);
+  free(buf);
+  return mismatches != 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) return bench_calls();
+  if (argc > 1 && strcmp(argv[1], "--bench-reactive") == 0) return bench_reactive();
+  if (argc > 1 && strcmp(argv[1], "--stress") == 0) return stress();
+  if (argc > 1 && strcmp(argv[1], "--bench-lex") == 0) return bench_lex();
+
   printf("Hello!\n");
 
   #define BUF_SIZE 1024
+  #define CACHE_SIZE 256
   char buf[BUF_SIZE];
-  VarEntryVec ctx = {0};
+  Env env = {0};
+  env.reactive = argc > 1 && strcmp(argv[1], "--reactive") == 0;
+  ProgramCache cache = cache_new(CACHE_SIZE);
 
   while(1) {
     fputs("> ", stdout);
-    stdin_read_line(buf, BUF_SIZE);
-
-    Parser parser = parse(buf);
-    if (parser.err == NoErr) {
-      printf("Result: %lf\n", eval(&parser, &ctx));
-      // for(int i=0; i<parser.tokens.len; i++) token_dbg(parser.tokens, i);
-      // for(int i=0; i<parser.ast.len; i++) expr_dbg(parser.ast, i); 
-      // for(int i=0; i<ctx.len; i++) printf("Var - id: %d, name: %s, val: %lf\n", i, ctx.data[i].name, ctx.data[i].val); 
+    if (!stdin_read_line(buf, BUF_SIZE)) break;
+
+    if (strcmp(buf, ":stats\n") == 0) {
+      cache_print_stats(&cache);
+      continue;
     }
 
-    parser_free(&parser);
+    if (is_fn_definition(buf)) {
+      int id = define_function(&env, buf);
+      if (id != -1) {
+        FuncDef* f = &env.funcs.data[id];
+        printf("Defined %s/%d%s\n", f->name, f->arity, f->pure ? " (pure)" : "");
+        // cached programs may have bound or folded an older definition
+        cache_clear(&cache);
+      }
+      continue;
+    }
+
+    Program* prog = cache_get(&cache, buf, &env);
+    if (prog != NULL) {
+      printf("Result: %lf\n", eval(prog, &env));
+      // for(int i=0; i<prog->ast.len; i++) expr_dbg(prog->ast, i); 
+      // for(int i=0; i<env.vars.len; i++) printf("Var - id: %d, name: %s, val: %lf\n", i, env.vars.data[i].name, env.vars.data[i].val);
+    }
   }
 
+  cache_free(&cache);
+  env_free(&env);
   return 0;
 }
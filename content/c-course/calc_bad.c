@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
+#include <sys/resource.h>
 
 #define arrdef(_type, _name) \
   typedef struct { \
@@ -34,6 +36,7 @@ typedef enum {
   Token_EOF,
   Token_Number,
   Token_Symbol,
+  Token_Error,
 } TokenKind;
 
 typedef enum {
@@ -44,6 +47,14 @@ typedef enum {
   Sym_Sub,
   Sym_Mul,
   Sym_Div,
+  Sym_Rem,
+  Sym_Pow,
+  Sym_Lt,
+  Sym_Le,
+  Sym_Gt,
+  Sym_Ge,
+  Sym_Eq,
+  Sym_Ne,
 } SymbolKind;
 
 typedef struct {
@@ -52,6 +63,7 @@ typedef struct {
   union {
     double num;
     SymbolKind sym;
+    char* msg;
   };
 } Token;
 
@@ -64,12 +76,12 @@ Token token_new_num(double num, int start, int len) {
   };
 }
 
-Token token_new_sym(SymbolKind sym, int start) {
+Token token_new_sym(SymbolKind sym, int start, int len) {
   return (Token) {
     .kind = Token_Symbol,
     .sym = sym,
     .start = start,
-    .len = 1,
+    .len = len,
   };
 }
 
@@ -79,6 +91,94 @@ Token token_eof() {
   };
 }
 
+Token token_err(char* msg, int start, int len) {
+  return (Token) {
+    .kind = Token_Error,
+    .msg = msg,
+    .start = start,
+    .len = len,
+  };
+}
+
+// lexes one token at a time, straight from the source, when the parser
+// asks for it. the source has to be zero terminated
+typedef struct {
+  char* s;
+  int pos;
+} Lexer;
+
+Lexer lexer_new(char* s) {
+  return (Lexer) { .s = s, .pos = 0 };
+}
+
+Token lexer_next(Lexer* l) {
+  char* s = l->s;
+  while (s[l->pos] == ' ' || s[l->pos] == '\n' || s[l->pos] == '\t' || s[l->pos] == '\r') {
+    l->pos += 1;
+  }
+
+  int start = l->pos;
+  char c = s[start];
+  SymbolKind sym = Sym_None;
+  int len = 1;
+
+  switch (c) {
+    case '\0': return token_eof();
+    case '(': sym = Sym_ParenLeft; break;
+    case ')': sym = Sym_ParenRight; break;
+    case '+': sym = Sym_Add; break;
+    case '-': sym = Sym_Sub; break;
+    case '*': sym = Sym_Mul; break;
+    case '/': sym = Sym_Div; break;
+    case '%': sym = Sym_Rem; break;
+    case '^': sym = Sym_Pow; break;
+    // only look past c once we know it's not the terminator
+    case '<': len += s[start+1] == '='; sym = len == 2 ? Sym_Le : Sym_Lt; break;
+    case '>': len += s[start+1] == '='; sym = len == 2 ? Sym_Ge : Sym_Gt; break;
+    case '=':
+    case '!': {
+      if (s[start+1] != '=') {
+        l->pos += 1;
+        return token_err("expected '='", start, 1);
+      }
+      sym = c == '=' ? Sym_Eq : Sym_Ne;
+      len = 2;
+      break;
+    }
+
+    default: {
+      if (!isdigit(c)) {
+        l->pos += 1;
+        return token_err("unexpected character", start, 1);
+      }
+
+      // digits, optionally followed by a dot and more digits
+      int end = start;
+      while (isdigit(s[end])) end += 1;
+      if (s[end] == '.') {
+        end += 1;
+        while (isdigit(s[end])) end += 1;
+      }
+
+      // reject 1.2.3, 12abc and the like, instead of silently
+      // cutting them. this also guarantees strtod stops where we did
+      if (s[end] == '.' || isalnum(s[end]) || s[end] == '_') {
+        while (s[end] == '.' || isalnum(s[end]) || s[end] == '_') end += 1;
+        l->pos = end;
+        return token_err("malformed number", start, end-start);
+      }
+
+      l->pos = end;
+      return token_new_num(strtod(s + start, NULL), start, end-start);
+    }
+  }
+
+  l->pos += len;
+  return token_new_sym(sym, start, len);
+}
+
+// the old tokenizer, which builds the whole token array up front.
+// it's only kept as a reference for the lexer fuzz test
 arrdef(Token, Token);
 arrdef(char, Char);
 TokenArray tokenize(char* s, int size) {
@@ -87,6 +187,9 @@ TokenArray tokenize(char* s, int size) {
   
   for (int i=0; i<size; ++i) {
     SymbolKind curr = Sym_None;
+    int start = i;
+    bool next_is_eq = i+1 < size && s[i+1] == '=';
+
     switch (s[i]) {
       case '(': curr = Sym_ParenLeft; break;
       case ')': curr = Sym_ParenRight; break;
@@ -94,6 +197,22 @@ TokenArray tokenize(char* s, int size) {
       case '-': curr = Sym_Sub; break;
       case '*': curr = Sym_Mul; break;
       case '/': curr = Sym_Div; break;
+      case '%': curr = Sym_Rem; break;
+      case '^': curr = Sym_Pow; break;
+      case '<': curr = next_is_eq ? Sym_Le : Sym_Lt; break;
+      case '>': curr = next_is_eq ? Sym_Ge : Sym_Gt; break;
+      case '=':
+      case '!': {
+        if (next_is_eq) {
+          curr = s[i] == '=' ? Sym_Eq : Sym_Ne;
+          break;
+        }
+
+        printf("Tokenizer error: expected '=' at %d\n", i+1);
+        arrfree(tokens);
+        arrfree(num_buf);
+        return (TokenArray) {0};
+      }
       case ' ':
       case '\n':
       case '\t': break;
@@ -121,7 +240,13 @@ TokenArray tokenize(char* s, int size) {
     }
 
     if (curr != Sym_None) {
-      Token t = token_new_sym(curr, i);
+      int len = 1;
+      if (next_is_eq && (curr == Sym_Le || curr == Sym_Ge || curr == Sym_Eq || curr == Sym_Ne)) {
+        len = 2;
+        i += 1;
+      }
+
+      Token t = token_new_sym(curr, start, len);
       arrpush(tokens, t);
     }
   }
@@ -137,58 +262,64 @@ typedef enum {
   Expr_Binary,
 } ExprKind;
 
+// nodes live in a pool and point to their children by index,
+// so a whole tree is freed at once by resetting the pool
+typedef int ExprId;
+
+typedef struct {
+  ExprId right;
+  Token operator;
+} ExprUnary;
 
-struct Expr;
-struct ExprUnary;
-struct ExprBinary;
+typedef struct {
+  ExprId left, right;
+  Token operator;
+} ExprBinary;
 
-struct Expr {
+typedef struct {
   ExprKind kind;
   union {
     double num;
-    struct ExprUnary* unr;
-    struct ExprBinary* bin;
+    ExprUnary unr;
+    ExprBinary bin;
   };
-};
+} Expr;
 
-struct ExprUnary {
-  struct Expr *right;
-  Token operator;
-};
+arrdef(Expr, Expr);
 
-struct ExprBinary {
-  struct Expr *left, *right;
-  Token operator;
-};
+ExprId expr_push(ExprArray* pool, Expr e) {
+  arrpush(*pool, e);
+  return pool->len-1;
+}
 
-typedef struct Expr Expr;
-typedef struct ExprBinary ExprBinary;
+ExprId expr_undefined(ExprArray* pool) {
+  Expr e = { .kind = Expr_Undefined };
+  return expr_push(pool, e);
+}
 
-Expr* expr_undefined() {
-  Expr* res = malloc(sizeof(Expr));
-  res->kind = Expr_Undefined;
-  return res;
+ExprId expr_new_number(ExprArray* pool, double num) {
+  Expr e = { .kind = Expr_Number, .num = num };
+  return expr_push(pool, e);
 }
 
-Expr* expr_new_number(double num) {
-  Expr* res = malloc(sizeof(Expr));
-  res->kind = Expr_Number;
-  res->num = num;
-  return res;
+ExprId expr_new_unary(ExprArray* pool, Token op, ExprId right) {
+  Expr e = {
+    .kind = Expr_Unary,
+    .unr = { .right = right, .operator = op },
+  };
+  return expr_push(pool, e);
 }
 
-Expr* expr_new_binary(Expr* left, Token op, Expr* right) {
-  Expr* res = malloc(sizeof(Expr));
-  ExprBinary* bin = malloc(sizeof(ExprBinary));
-  res->kind = Expr_Binary;
-  bin->left = left;
-  bin->right = right;
-  bin->operator = op;
-  res->bin = bin;
-  return res;
+ExprId expr_new_binary(ExprArray* pool, ExprId left, Token op, ExprId right) {
+  Expr e = {
+    .kind = Expr_Binary,
+    .bin = { .left = left, .right = right, .operator = op },
+  };
+  return expr_push(pool, e);
 }
 
-void expr_print(Expr* e) {
+void expr_print(ExprArray* pool, ExprId id) {
+  Expr* e = &pool->data[id];
   printf("Expr: %d\n", e->kind);
   switch (e->kind) {
     case Expr_Number: {
@@ -196,10 +327,16 @@ void expr_print(Expr* e) {
       break;
     }
 
+    case Expr_Unary: {
+      printf("[Operator %d]\n", e->unr.operator.sym);
+      expr_print(pool, e->unr.right);
+      break;
+    }
+
     case Expr_Binary: {
-      if (e->bin->left != NULL) expr_print(e->bin->left);
-      printf("[Operator %d]\n", e->bin->operator.kind);
-      if (e->bin->right != NULL) expr_print(e->bin->right);
+      expr_print(pool, e->bin.left);
+      printf("[Operator %d]\n", e->bin.operator.sym);
+      expr_print(pool, e->bin.right);
       break;
     }
 
@@ -210,61 +347,100 @@ void expr_print(Expr* e) {
   }
 }
 
-// Expr -> ( Add ) | Number
-// Mult -> Expr (*|/ Expr)*
-// Add -> Mult (+|- Mult)*
+// Primary -> ( Binary ) | Number | - Binary(UNARY_PREC)
+// Binary(min) -> Primary (op Binary(prec(op) + 1, or prec(op) if right assoc))*
+//   while prec(op) >= min
+//
+// every binary operator is described by the table below, so adding one
+// doesn't add a parsing function. the parser only recurses when an operator
+// binds tighter than the one before it, or for parens
 
 typedef struct {
-  TokenArray tokens;
-  int curr;
+  int prec;
+  bool right_assoc;
+} OpInfo;
+
+// prec 0 means not a binary operator
+const OpInfo OPERATORS[] = {
+  [Sym_Eq]  = { 1, false },
+  [Sym_Ne]  = { 1, false },
+  [Sym_Lt]  = { 2, false },
+  [Sym_Le]  = { 2, false },
+  [Sym_Gt]  = { 2, false },
+  [Sym_Ge]  = { 2, false },
+  [Sym_Add] = { 3, false },
+  [Sym_Sub] = { 3, false },
+  [Sym_Mul] = { 4, false },
+  [Sym_Div] = { 4, false },
+  [Sym_Rem] = { 4, false },
+  [Sym_Pow] = { 6, true },
+};
+
+// unary minus binds tighter than * but looser than ^, so -2^2 is -4
+#define UNARY_PREC 5
+
+OpInfo op_info(Token t) {
+  if (t.kind != Token_Symbol) return (OpInfo) { 0 };
+  return OPERATORS[t.sym];
+}
+
+#define PARSER_ERR_SIZE 256
+
+typedef struct {
+  Lexer lexer;
+  Token curr;
+  ExprArray* pool;
   char* err;
 } Parser;
 
 Token parser_peek(Parser* p) {
-  if (p->curr >= p->tokens.len)
-    return token_eof();
-
-  return p->tokens.data[p->curr];
+  return p->curr;
 }
 
 Token parser_consume(Parser* p) {
-  Token t = parser_peek(p);
-  p->curr += 1;
+  Token t = p->curr;
+  if (t.kind != Token_EOF) p->curr = lexer_next(&p->lexer);
   return t;
 }
 
-Expr* parser_err(Parser* p, char* msg, Token t) {
-  char* buf = malloc(256);
-  snprintf(buf, 256, "%s at %d, long %d", msg, t.start, t.len);
-  p->err = buf;
-  return expr_undefined();
+ExprId parser_err(Parser* p, char* msg, Token t) {
+  // keep the first error, the later ones are usually caused by it
+  if (p->err[0] == '\0') {
+    snprintf(p->err, PARSER_ERR_SIZE, "%s at %d, long %d", msg, t.start, t.len);
+  }
+  return expr_undefined(p->pool);
 }
 
-Expr* parse_expr(Parser* p);
-Expr* parse_add(Parser* p);
-Expr* parse_mul(Parser* p);
+ExprId parse_binary(Parser* p, int min_prec);
 
-Expr* parse_expr(Parser* p) {
+ExprId parse_primary(Parser* p) {
   Token t = parser_peek(p);
 
   switch (t.kind) {
     case Token_Number: {
       parser_consume(p);
-      return expr_new_number(t.num);
+      return expr_new_number(p->pool, t.num);
     }
 
     case Token_Symbol: {
       switch (t.sym) {
         case Sym_ParenLeft: {
           parser_consume(p);
-          Expr* expr = parse_add(p);
-          if (parser_peek(p).sym != Sym_ParenRight) {
+          ExprId expr = parse_binary(p, 1);
+          Token close = parser_peek(p);
+          if (close.kind != Token_Symbol || close.sym != Sym_ParenRight) {
             return parser_err(p, "missing right parenthesis", t);
           }
           parser_consume(p);
           return expr;
         }
 
+        case Sym_Sub: {
+          parser_consume(p);
+          ExprId right = parse_binary(p, UNARY_PREC);
+          return expr_new_unary(p->pool, t, right);
+        }
+
         case Sym_ParenRight: {
           return parser_err(p, "missing left parenthesis", t);
         }
@@ -276,7 +452,11 @@ Expr* parse_expr(Parser* p) {
     }
 
     case Token_EOF: {
-      return expr_undefined();
+      return parser_err(p, "unexpected end of input", t);
+    }
+
+    case Token_Error: {
+      return parser_err(p, t.msg, t);
     }
 
     default: {
@@ -285,67 +465,86 @@ Expr* parse_expr(Parser* p) {
   }
 }
 
-Expr* parse_mul(Parser* p) {
-  Expr* left = parse_expr(p);
-  Token t = parser_peek(p);
-
-  while (t.sym == Sym_Mul || t.sym == Sym_Div) {
-    parser_consume(p);
-    Expr* right = parse_expr(p);
-    left = expr_new_binary(left, t, right);
-    t = parser_peek(p);
-  }
-
-  return left;
-}
+ExprId parse_binary(Parser* p, int min_prec) {
+  ExprId left = parse_primary(p);
 
-Expr* parse_add(Parser* p) {
-  Expr* left = parse_mul(p);
-  Token t = parser_peek(p);
+  while (true) {
+    Token t = parser_peek(p);
+    OpInfo op = op_info(t);
+    if (op.prec == 0 || op.prec < min_prec) break;
 
-  while (t.sym == Sym_Add || t.sym == Sym_Sub) {
     parser_consume(p);
-    Expr* right = parse_mul(p);
-    left = expr_new_binary(left, t, right);
-    t = parser_peek(p);
+    ExprId right = parse_binary(p, op.right_assoc ? op.prec : op.prec + 1);
+    left = expr_new_binary(p->pool, left, t, right);
   }
 
   return left;
 }
 
-Expr* parse(TokenArray tokens) {
-  Parser p = { .tokens = tokens, .curr = 0, .err = NULL };
-  Expr* res = parse_add(&p);
-
-  arrfree(tokens);
+// the tree is built in pool, which the caller resets after evaluating it.
+// on failure the message is written in err, PARSER_ERR_SIZE bytes long.
+// a blank line gives an undefined expression and no error
+ExprId parse(char* src, ExprArray* pool, char* err) {
+  err[0] = '\0';
+  Parser p = { .lexer = lexer_new(src), .pool = pool, .err = err };
+  p.curr = lexer_next(&p.lexer);
+  if (p.curr.kind == Token_EOF) return expr_undefined(pool);
+
+  ExprId res = parse_binary(&p, 1);
+
+  // everything has to be consumed, as in "1 2" or "1 )"
+  Token rest = parser_peek(&p);
+  if (rest.kind == Token_Error) {
+    parser_err(&p, rest.msg, rest);
+  } else if (rest.kind != Token_EOF) {
+    parser_err(&p, "unexpected token after expression", rest);
+  }
 
-  if (p.err != NULL) {
-    printf("Parser error: %s\n", p.err);
-    return expr_undefined();
+  if (err[0] != '\0') {
+    return expr_undefined(pool);
   }
 
   return res;
 }
 
-double evaluate(Expr* e) {
+double evaluate(ExprArray* pool, ExprId id) {
+  Expr* e = &pool->data[id];
+
   switch (e->kind) {
     case Expr_Number: {
-      double res = e->num;
-      // free(e);
-      return res;
+      return e->num;
+    }
+
+    case Expr_Unary: {
+      double right = evaluate(pool, e->unr.right);
+
+      switch (e->unr.operator.sym) {
+        case Sym_Sub: return -right;
+        default: {
+          printf("unexpected operatr kind\n");
+          return 0;
+        }
+      }
     }
 
     case Expr_Binary: {
-      double left = evaluate(e->bin->left);
-      double right = evaluate(e->bin->right);
-      // free(e->bin);
-      // free(e);
+      double left = evaluate(pool, e->bin.left);
+      double right = evaluate(pool, e->bin.right);
 
-      switch (e->bin->operator.sym) {
+      switch (e->bin.operator.sym) {
         case Sym_Add: return left + right;
         case Sym_Sub: return left - right;
         case Sym_Mul: return left * right;
         case Sym_Div: return left / right;
+        case Sym_Rem: return fmod(left, right);
+        case Sym_Pow: return pow(left, right);
+        // comparisons give 1 or 0
+        case Sym_Lt: return left < right;
+        case Sym_Le: return left <= right;
+        case Sym_Gt: return left > right;
+        case Sym_Ge: return left >= right;
+        case Sym_Eq: return left == right;
+        case Sym_Ne: return left != right;
         default: {
           printf("unexpected operatr kind\n");
           return 0;
@@ -354,28 +553,159 @@ double evaluate(Expr* e) {
     }
 
     default: {
-      // free(e);
       printf("unexpected expression kind\n");
       return 0;
     }
   }
 }
 
-int main() {
+long peak_rss_kb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// evaluates generated lines over and over, reusing the same pool,
+// and fails if the peak memory keeps growing after the warm up
+int soak(long lines) {
+  ExprArray pool = { 0 };
   char buf[256];
+  char err[PARSER_ERR_SIZE];
+  double sum = 0;
+  long warm_rss = 0;
+  srand(1);
+
+  for (long i=0; i<lines; ++i) {
+    // every 16th line doesn't parse, to go through the error path too
+    if (i % 16 == 15) {
+      snprintf(buf, sizeof(buf), "( %d + %d ", rand() % 100, rand() % 100);
+    } else {
+      snprintf(buf, sizeof(buf), "( %d.%d + %d ) * %d - %d / ( %d + 1 ) ",
+        rand() % 1000, rand() % 100, rand() % 1000, rand() % 10, rand() % 1000, rand() % 10);
+    }
+
+    ExprId expr = parse(buf, &pool, err);
+    if (pool.data[expr].kind != Expr_Undefined) {
+      sum += evaluate(&pool, expr);
+    }
+    pool.len = 0;
+
+    if (i == lines / 10) warm_rss = peak_rss_kb();
+  }
+
+  long end_rss = peak_rss_kb();
+  printf("%ld lines, peak rss after warm up %ld kB, at the end %ld kB (checksum %g)\n",
+    lines, warm_rss, end_rss, sum);
+  arrfree(pool);
+
+  return end_rss > warm_rss + 1024;
+}
+
+bool tokens_equal(Token a, Token b) {
+  if (a.kind != b.kind) return false;
+  if (a.kind == Token_Number) return a.num == b.num;
+  if (a.kind == Token_Symbol) return a.sym == b.sym;
+  return true;
+}
+
+// generates random valid lines and checks the lexer gives the same
+// token stream as the old tokenizer, then throws random bytes at the
+// lexer alone to check it always terminates.
+// the old tokenizer skips the character after a number, so the
+// generated lines always put a space there. symbols get one too,
+// or "<" followed by "==" would make "<=="
+// the lexer always gets an exact size heap copy of the line, so reading
+// past the terminator shows up under asan
+int fuzz_lexer(long lines) {
+  char* syms[] = { "(", ")", "+", "-", "*", "/", "%", "^", "<", "<=", ">", ">=", "==", "!=" };
+  int syms_count = sizeof(syms) / sizeof(char*);
+  char buf[512];
+  long mismatches = 0;
+  srand(7);
+
+  for (long i=0; i<lines; ++i) {
+    int len = 0;
+    int count = rand() % 24;
+    buf[0] = '\0';
+    for (int j=0; j<count; ++j) {
+      len += snprintf(buf + len, sizeof(buf) - len, "%*s", rand() % 3, "");
+      switch (rand() % 3) {
+        case 0: len += snprintf(buf + len, sizeof(buf) - len, "%d ", rand() % 100000); break;
+        case 1: len += snprintf(buf + len, sizeof(buf) - len, "%d.%d ", rand() % 1000, rand() % 100000); break;
+        case 2: len += snprintf(buf + len, sizeof(buf) - len, "%s ", syms[rand() % syms_count]); break;
+      }
+    }
+
+    TokenArray expected = tokenize(buf, len);
+    char* line = strdup(buf);
+    Lexer lexer = lexer_new(line);
+    unsigned int j = 0;
+
+    while (true) {
+      Token t = lexer_next(&lexer);
+      Token e = j < expected.len ? expected.data[j] : token_eof();
+      if (!tokens_equal(t, e)) {
+        printf("mismatch on token %u of \"%s\"\n", j, buf);
+        mismatches += 1;
+        break;
+      }
+      if (t.kind == Token_EOF) break;
+      j += 1;
+    }
+
+    free(line);
+    arrfree(expected);
+  }
+
+  for (long i=0; i<lines; ++i) {
+    int len = rand() % (sizeof(buf) - 1);
+    for (int j=0; j<len; ++j) buf[j] = 1 + rand() % 127;
+    buf[len] = '\0';
+
+    char* line = strdup(buf);
+    Lexer lexer = lexer_new(line);
+    int tokens = 0;
+    while (lexer_next(&lexer).kind != Token_EOF) {
+      if (++tokens > len) {
+        printf("lexer doesn't terminate on \"%s\"\n", buf);
+        mismatches += 1;
+        break;
+      }
+    }
+    free(line);
+  }
+
+  printf("%ld valid and %ld random lines, %ld mismatches\n", lines, lines, mismatches);
+  return mismatches != 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2 && strcmp(argv[1], "--soak") == 0) {
+    return soak(atol(argv[2]));
+  }
+
+  if (argc > 2 && strcmp(argv[1], "--fuzz-lexer") == 0) {
+    return fuzz_lexer(atol(argv[2]));
+  }
+
+  char buf[256];
+  char err[PARSER_ERR_SIZE];
+  ExprArray pool = { 0 };
 
   while (true) {
     printf("> ");
-    fgets(buf, 256, stdin);
-    TokenArray tokens = tokenize(buf, strlen(buf));
-    if (tokens.len == 0) continue;
-    printf("Scanning done\n");
-    Expr* expr = parse(tokens);
+    if (fgets(buf, 256, stdin) == NULL) break;
+    ExprId expr = parse(buf, &pool, err);
+    if (err[0] != '\0') printf("Parser error: %s\n", err);
     printf("Parsing done\n");
-    if (expr->kind != Expr_Undefined) {
-      printf("%f\n", evaluate(expr));
+    if (pool.data[expr].kind != Expr_Undefined) {
+      printf("%f\n", evaluate(&pool, expr));
     }
+
+    // the whole tree goes away at once
+    pool.len = 0;
   }
 
+  arrfree(pool);
   return 0;
-}
\ No newline at end of file
+}
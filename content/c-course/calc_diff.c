@@ -0,0 +1,398 @@
+// differential harness for the two calculators.
+// it generates random expressions, checks that calc.c and calc_bad.c
+// give the same results, then measures each engine on its own.
+//
+//   gcc -O2 -o calc_diff calc_diff.c -lm
+//   ./calc_diff [lines] [ops per line] [max depth] [seed]
+//
+// both engines are included as they are, their mains are renamed and
+// the names calc_bad.c shares with calc.c are prefixed with bad_.
+// the generated expressions stay in the grammar both agree on:
+// unary minus binds looser than ^ in calc_bad.c and tighter in calc.c,
+// and % is at the * level in one and above ^ in the other,
+// so both are always wrapped in parens
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// every allocation made by the engines goes through these
+size_t allocations = 0;
+
+void* counted_malloc(size_t size) { allocations++; return malloc(size); }
+void* counted_calloc(size_t n, size_t size) { allocations++; return calloc(n, size); }
+void* counted_realloc(void* ptr, size_t size) { allocations++; return realloc(ptr, size); }
+char* counted_strdup(const char* s) { allocations++; return strdup(s); }
+char* counted_strndup(const char* s, size_t n) { allocations++; return strndup(s, n); }
+
+#undef strdup
+#undef strndup
+#define malloc(_size) counted_malloc(_size)
+#define calloc(_n, _size) counted_calloc(_n, _size)
+#define realloc(_ptr, _size) counted_realloc(_ptr, _size)
+#define strdup(_s) counted_strdup(_s)
+#define strndup(_s, _n) counted_strndup(_s, _n)
+
+#define main calc_main
+#include "calc.c"
+#undef main
+
+#define main bad_main
+#define Token BadCalcToken
+#define tokenize bad_tokenize
+#define Expr BadExpr
+#define ExprUnary BadExprUnary
+#define ExprBinary BadExprBinary
+#define Parser BadParser
+#define parser_peek bad_parser_peek
+#define parse bad_parse
+#include "calc_bad.c"
+#undef main
+#undef Token
+#undef tokenize
+#undef Expr
+#undef ExprUnary
+#undef ExprBinary
+#undef Parser
+#undef parser_peek
+#undef parse
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+#undef strndup
+
+// the common entry point. every engine keeps its state in ctx:
+// parse returns the number of nodes of the parsed expression,
+// or -1 on error. eval runs the last parsed expression, reset drops it
+typedef struct {
+  char* name;
+  void* ctx;
+  void (*init)(void* ctx);
+  int (*parse)(void* ctx, char* src);
+  double (*eval)(void* ctx);
+  void (*reset)(void* ctx);
+  void (*cleanup)(void* ctx);
+} Engine;
+
+typedef struct {
+  Env env;
+  Program prog;
+  int no_fold;
+} CalcState;
+
+void calc_init(void* ctx) {
+  CalcState* s = ctx;
+  s->env = (Env) { .no_fold = s->no_fold };
+}
+
+int calc_parse(void* ctx, char* src) {
+  CalcState* s = ctx;
+  Parser p = parse(src, &s->env);
+  if (p.err != NoErr) {
+    parser_free(&p);
+    return -1;
+  }
+  s->prog = program_from_parser(&p);
+  parser_free(&p);
+  return s->prog.ast.len;
+}
+
+double calc_eval(void* ctx) {
+  CalcState* s = ctx;
+  return eval(&s->prog, &s->env);
+}
+
+void calc_reset(void* ctx) { program_free(&((CalcState*) ctx)->prog); }
+void calc_cleanup(void* ctx) { env_free(&((CalcState*) ctx)->env); }
+
+typedef struct {
+  ExprArray pool;
+  ExprId root;
+} BadState;
+
+void bad_init(void* ctx) { ((BadState*) ctx)->pool = (ExprArray) {0}; }
+
+int bad_parse_line(void* ctx, char* src) {
+  BadState* s = ctx;
+  char err[PARSER_ERR_SIZE];
+  s->root = bad_parse(src, &s->pool, err);
+  if (err[0] != '\0') return -1;
+  return s->pool.len;
+}
+
+double bad_eval(void* ctx) {
+  BadState* s = ctx;
+  return evaluate(&s->pool, s->root);
+}
+
+void bad_reset(void* ctx) { ((BadState*) ctx)->pool.len = 0; }
+void bad_cleanup(void* ctx) { arrfree(((BadState*) ctx)->pool); }
+
+CalcState calc_state = { .no_fold = 0 };
+CalcState calc_no_fold_state = { .no_fold = 1 };
+BadState bad_state;
+
+const Engine ENGINES[] = {
+  { "calc",           &calc_state,         calc_init, calc_parse,     calc_eval, calc_reset, calc_cleanup },
+  { "calc (no fold)", &calc_no_fold_state, calc_init, calc_parse,     calc_eval, calc_reset, calc_cleanup },
+  { "calc_bad",       &bad_state,          bad_init,  bad_parse_line, bad_eval,  bad_reset,  bad_cleanup },
+};
+#define ENGINES_COUNT (int) (sizeof(ENGINES) / sizeof(Engine))
+
+// expression generator. ops_left bounds the number of operators in
+// the line, max_depth the nesting of parens
+typedef struct {
+  char* buf;
+  int len, cap;
+  int ops_left;
+  int max_depth;
+  int tokens;
+} Gen;
+
+void gen_emit(Gen* g, char* str) {
+  g->len += snprintf(g->buf + g->len, g->cap - g->len, "%s ", str);
+  g->tokens++;
+}
+
+void gen_number(Gen* g) {
+  if (rand() % 2) {
+    g->len += snprintf(g->buf + g->len, g->cap - g->len, "%d ", rand() % 1000);
+  } else {
+    g->len += snprintf(g->buf + g->len, g->cap - g->len, "%d.%d ", rand() % 100, rand() % 1000);
+  }
+  g->tokens++;
+}
+
+void gen_chain(Gen* g, int depth);
+
+void gen_operand(Gen* g, int depth) {
+  int r = rand() % 8;
+  bool can_nest = depth < g->max_depth && g->ops_left > 0;
+
+  if (can_nest && r < 3) {
+    gen_emit(g, "(");
+    gen_chain(g, depth + 1);
+    gen_emit(g, ")");
+  } else if (can_nest && r == 3) {
+    gen_emit(g, "(");
+    gen_emit(g, "-");
+    gen_operand(g, depth + 1);
+    gen_emit(g, ")");
+  } else if (can_nest && r == 4) {
+    g->ops_left--;
+    gen_emit(g, "(");
+    gen_number(g);
+    gen_emit(g, "%");
+    gen_number(g);
+    gen_emit(g, ")");
+  } else {
+    gen_number(g);
+  }
+}
+
+// operand (op operand)*, stops early when the operators run out
+void gen_chain(Gen* g, int depth) {
+  static char* ops[] = { "+", "-", "*", "/", "^" };
+  gen_operand(g, depth);
+
+  int count = depth == 0 ? g->ops_left : 1 + rand() % 4;
+  for (int i=0; i<count && g->ops_left > 0; ++i) {
+    g->ops_left--;
+    char* op = ops[rand() % 5];
+    gen_emit(g, op);
+    // keeps powers from overflowing everything to inf
+    if (op[0] == '^') {
+      g->len += snprintf(g->buf + g->len, g->cap - g->len, "%d ", rand() % 3);
+      g->tokens++;
+    } else {
+      gen_operand(g, depth);
+    }
+  }
+}
+
+// lines are stored back to back, each one NUL terminated
+typedef struct {
+  char* data;
+  size_t* starts;
+  int count;
+  size_t tokens;
+} Lines;
+
+Lines gen_lines(int count, int ops, int depth, unsigned seed) {
+  // every op brings at most two operands, and each of them is a number
+  // of up to 8 chars behind at most depth "( - " and their ")"
+  int cap = (ops * 2 + 1) * (depth * 8 + 24) + 64;
+  Lines lines = { malloc((size_t) count * cap), malloc(count * sizeof(size_t)), count, 0 };
+  size_t len = 0;
+  srand(seed);
+
+  for (int i=0; i<count; ++i) {
+    Gen g = { lines.data + len, 0, cap, ops, depth, 0 };
+    gen_chain(&g, 0);
+    lines.starts[i] = len;
+    lines.tokens += g.tokens;
+    len += g.len + 1;
+  }
+
+  return lines;
+}
+
+bool values_agree(double a, double b) {
+  if (isnan(a) || isnan(b)) return isnan(a) && isnan(b);
+  if (a == b) return true;
+  return fabs(a - b) <= 1e-9 * fmax(fabs(a), fabs(b));
+}
+
+// runs every line through every engine and compares with the first one.
+// returns the number of lines where they disagree
+int check_agreement(Lines* lines) {
+  int mismatches = 0;
+  for (int e=0; e<ENGINES_COUNT; ++e) ENGINES[e].init(ENGINES[e].ctx);
+
+  for (int i=0; i<lines->count; ++i) {
+    char* src = lines->data + lines->starts[i];
+    double res[ENGINES_COUNT];
+    bool ok[ENGINES_COUNT];
+
+    for (int e=0; e<ENGINES_COUNT; ++e) {
+      ok[e] = ENGINES[e].parse(ENGINES[e].ctx, src) != -1;
+      res[e] = ok[e] ? ENGINES[e].eval(ENGINES[e].ctx) : NAN;
+      if (ok[e]) ENGINES[e].reset(ENGINES[e].ctx);
+    }
+
+    bool agree = true;
+    for (int e=1; e<ENGINES_COUNT; ++e) {
+      agree &= ok[e] == ok[0] && values_agree(res[e], res[0]);
+    }
+    if (agree) continue;
+
+    // the first few are enough to start debugging
+    if (mismatches++ < 5) {
+      printf("mismatch on line %d: %s\n", i, src);
+      for (int e=0; e<ENGINES_COUNT; ++e) {
+        printf("  %-16s %s %.17g\n", ENGINES[e].name, ok[e] ? "=" : "parse error,", res[e]);
+      }
+    }
+  }
+
+  for (int e=0; e<ENGINES_COUNT; ++e) ENGINES[e].cleanup(ENGINES[e].ctx);
+  return mismatches;
+}
+
+typedef struct {
+  double parse_ns;
+  double eval_ns;
+  size_t nodes;
+  size_t allocations;
+  long rss_kb;
+  double checksum;
+} EngineStats;
+
+// lines are timed one by one, so the cost of reading
+// the clock is taken out of every measurement
+double clock_overhead_ns() {
+  double start = time_now_ns();
+  for (int i=0; i<1000; ++i) time_now_ns();
+  return (time_now_ns() - start) / 1000;
+}
+
+EngineStats bench_engine(const Engine* engine, Lines* lines) {
+  EngineStats s = {0};
+  double overhead = clock_overhead_ns();
+  long base_rss = peak_rss_kb();
+  allocations = 0;
+  engine->init(engine->ctx);
+
+  for (int i=0; i<lines->count; ++i) {
+    char* src = lines->data + lines->starts[i];
+
+    double start = time_now_ns();
+    int nodes = engine->parse(engine->ctx, src);
+    double parsed = time_now_ns();
+    if (nodes == -1) continue;
+    double val = engine->eval(engine->ctx);
+    double evaluated = time_now_ns();
+    engine->reset(engine->ctx);
+
+    s.parse_ns += fmax(parsed - start - overhead, 0);
+    s.eval_ns += fmax(evaluated - parsed - overhead, 0);
+    s.nodes += nodes;
+    if (isfinite(val)) s.checksum += val;
+  }
+
+  engine->cleanup(engine->ctx);
+  s.allocations = allocations;
+  s.rss_kb = peak_rss_kb() - base_rss;
+  return s;
+}
+
+// every engine runs in its own child process, so the peak rss
+// is its own and not the one of whoever ran before it
+EngineStats bench_engine_isolated(const Engine* engine, Lines* lines) {
+  EngineStats s = {0};
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return s;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    s = bench_engine(engine, lines);
+    write(fds[1], &s, sizeof(s));
+    _exit(0);
+  }
+
+  close(fds[1]);
+  if (pid < 0 || read(fds[0], &s, sizeof(s)) != sizeof(s)) {
+    fprintf(stderr, "benchmark of %s failed\n", engine->name);
+  }
+  close(fds[0]);
+  if (pid > 0) waitpid(pid, NULL, 0);
+  return s;
+}
+
+int main(int argc, char** argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 20000;
+  int ops = argc > 2 ? atoi(argv[2]) : 32;
+  int depth = argc > 3 ? atoi(argv[3]) : 4;
+  unsigned seed = argc > 4 ? atoi(argv[4]) : 1;
+  if (count <= 0 || ops < 0 || depth < 0) {
+    fprintf(stderr, "usage: %s [lines] [ops per line] [max depth] [seed]\n", argv[0]);
+    return 1;
+  }
+
+  Lines lines = gen_lines(count, ops, depth, seed);
+  printf("%d lines, %d ops and depth %d each, %.1f tokens per line (seed %u)\n",
+    count, ops, depth, (double) lines.tokens / count, seed);
+
+  // engines print their own parse errors, there shouldn't be any
+  int mismatches = check_agreement(&lines);
+  printf("%d mismatches\n\n", mismatches);
+
+  printf("%-16s %14s %12s %10s %11s %8s  %s\n",
+    "engine", "parse ns/tok", "eval ns/node", "nodes/line", "allocs/line", "rss +kB", "checksum");
+  for (int e=0; e<ENGINES_COUNT; ++e) {
+    EngineStats s = bench_engine_isolated(&ENGINES[e], &lines);
+    printf("%-16s %14.2f %12.2f %10.1f %11.2f %8ld  %g\n", ENGINES[e].name,
+      s.parse_ns / lines.tokens,
+      s.nodes == 0 ? 0.0 : s.eval_ns / s.nodes,
+      (double) s.nodes / count,
+      (double) s.allocations / count,
+      s.rss_kb, s.checksum);
+  }
+
+  free(lines.data);
+  free(lines.starts);
+  return mismatches != 0;
+}
@@ -1,21 +1,66 @@
+// for memmem, the baseline of --bench
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include <zlib.h>
 #include "stc_fs.h"
 #include "stc_str.h"
 
-int main(int argc, char** argv) {
-  if (argc < 3) {
-    printf("Missing args\n");
-    return 0;
-  }
-  
-  char* query = argv[1];
-  char* path  = argv[2];
+// counters for --stats, all printed on one line of key=value pairs.
+// they cost an add per line; only the time spent lowercasing and
+// matching is sampled, on the first line and one in SAMPLE_EVERY, and
+// the time of the scan, less the printing done in it, is split between
+// them in the same ratio. output_ns is that printing plus the final flush
+#define SAMPLE_EVERY 64
 
-  char* contents = file_read_to_string(path);
-  if (contents == NULL) return 0;
+typedef struct {
+  bool on;
+  char* path;
+  uint64_t bytes, compressed_bytes, lines, matches;
+  uint64_t blocks, blocks_searched;
+  uint64_t load_ns, inflate_ns, scan_ns, scan_output_ns, flush_ns;
+  uint64_t sampled_lower_ns, sampled_match_ns;
+} Stats;
 
-  str query_str = str_from_cstr(query);
-  str contents_str = str_from_cstr(contents);
+Stats stats;
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_print(uint64_t total_ns) {
+  double sampled = stats.sampled_lower_ns + stats.sampled_match_ns;
+  uint64_t scan_ns = stats.scan_ns > stats.scan_output_ns ? stats.scan_ns - stats.scan_output_ns : 0;
+  uint64_t lower_ns = sampled > 0 ? scan_ns * (stats.sampled_lower_ns / sampled) : 0;
+  fprintf(stderr, "grep_stats path=%s bytes=%llu compressed_bytes=%llu lines=%llu matches=%llu"
+    " blocks=%llu blocks_searched=%llu load_ns=%llu inflate_ns=%llu lower_ns=%llu match_ns=%llu"
+    " output_ns=%llu total_ns=%llu gbps=%.3f\n",
+    stats.path, (unsigned long long) stats.bytes, (unsigned long long) stats.compressed_bytes,
+    (unsigned long long) stats.lines, (unsigned long long) stats.matches,
+    (unsigned long long) stats.blocks, (unsigned long long) stats.blocks_searched,
+    (unsigned long long) stats.load_ns, (unsigned long long) stats.inflate_ns,
+    (unsigned long long) lower_ns, (unsigned long long) (scan_ns - lower_ns),
+    (unsigned long long) (stats.scan_output_ns + stats.flush_ns), (unsigned long long) total_ns,
+    total_ns > 0 ? (double) stats.bytes / total_ns : 0);
+}
+
+// prints the lines of text that contain the query, ignoring case
+void grep_text(char* text, str query_str) {
+  str contents_str = str_from_cstr(text);
+  uint64_t start = stats.on ? now_ns() : 0;
 
   // StrList lines = str_split_lines(contents_str);
   // listforeach(str, line, &lines) {
@@ -32,13 +77,859 @@ int main(int argc, char** argv) {
   String lower = {0};
   while (!iter_at_end(&it)) {
     str line = iter_next_line(&it);
+    bool sample = stats.on && (++stats.lines % SAMPLE_EVERY == 0 || stats.lines == 1);
+    uint64_t t0 = sample ? now_ns() : 0;
     str_to_lower(&lower, line);
+    uint64_t t1 = sample ? now_ns() : 0;
     int i = str_match(String_to_str(lower), query_str);
+    if (sample) {
+      stats.sampled_lower_ns += t1 - t0;
+      stats.sampled_match_ns += now_ns() - t1;
+    }
     if (i != -1) {
+      uint64_t t = stats.on ? now_ns() : 0;
       printf(str_fmt "\n", str_arg(line));
+      if (stats.on) {
+        stats.matches++;
+        stats.scan_output_ns += now_ns() - t;
+      }
     }
   }
+  if (stats.on) stats.scan_ns += now_ns() - start;
   
   String_free(&lower);
-  free(contents);
+}
+
+// the trigram index of a file is file.tri next to it. the file is cut
+// in blocks of about BLOCK_SIZE, ending on a newline, and for every
+// trigram of lowercase bytes the index lists the blocks that have it.
+// a query only reads the blocks that have all of its trigrams.
+//   header
+//   block offsets, block_count + 1 of them
+//   entries, sorted by trigram, for a binary search
+//   postings: the block numbers of every trigram as varint deltas
+// the index remembers the size and mtime of the file, and isn't used
+// once they change
+#define BLOCK_SIZE (64 * 1024)
+#define INDEX_MAGIC "TRI"
+#define INDEX_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t file_size;
+  int64_t file_mtime;
+  uint64_t block_count;
+  uint64_t trigram_count;
+} IndexHeader;
+
+typedef struct {
+  uint32_t trigram;
+  uint32_t count;
+  uint64_t offset;
+} IndexEntry;
+
+typedef struct {
+  uint8_t* data;
+  size_t len, cap;
+} Bytes;
+
+void bytes_push(Bytes* b, uint8_t byte) {
+  if (b->len == b->cap) {
+    b->cap = b->cap == 0 ? 16 : b->cap * 2;
+    b->data = realloc(b->data, b->cap);
+  }
+  b->data[b->len++] = byte;
+}
+
+void varint_push(Bytes* b, uint64_t n) {
+  while (n >= 0x80) {
+    bytes_push(b, n | 0x80);
+    n >>= 7;
+  }
+  bytes_push(b, n);
+}
+
+// false if the number runs past end or doesn't fit in 64 bits
+bool varint_read(const uint8_t** p, const uint8_t* end, uint64_t* n) {
+  *n = 0;
+  for (int shift=0; shift < 64 && *p < end; shift += 7) {
+    uint8_t byte = *(*p)++;
+    *n |= (uint64_t) (byte & 0x7f) << shift;
+    if (byte < 0x80) return true;
+  }
+  return false;
+}
+
+uint8_t lower(uint8_t c) {
+  return c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+uint32_t trigram(const uint8_t* p) {
+  return lower(p[0]) << 16 | lower(p[1]) << 8 | lower(p[2]);
+}
+
+int64_t mtime_ns(struct stat* st) {
+  return (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+char* map_file(char* path, size_t* size, struct stat* st) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  char* data = NULL;
+  if (fstat(fd, st) == 0 && st->st_size > 0) {
+    data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) data = NULL;
+  }
+  close(fd);
+  *size = st->st_size;
+  return data;
+}
+
+int index_build(char* path) {
+  size_t size;
+  struct stat st;
+  // an empty file can't be mapped, but it isn't an error: it gets
+  // an index of no blocks
+  errno = 0;
+  uint8_t* data = (uint8_t*) map_file(path, &size, &st);
+  if (data == NULL && errno != 0) {
+    perror(path);
+    return 1;
+  }
+  if (data != NULL) madvise(data, size, MADV_SEQUENTIAL);
+
+  // postings of every trigram seen, found through a table of all 2^24
+  // trigrams. last is the last block added, plus one
+  typedef struct {
+    uint32_t last;
+    uint32_t count;
+    Bytes postings;
+  } Slot;
+  uint32_t* slot_of = calloc(1 << 24, sizeof(uint32_t));
+  Slot* slots = NULL;
+  size_t slots_len = 0, slots_cap = 0;
+  Bytes offsets = {0};
+
+  uint64_t block = 0;
+  for (size_t start=0; start<size; ++block) {
+    size_t end = start + BLOCK_SIZE < size ? start + BLOCK_SIZE : size;
+    while (end < size && data[end-1] != '\n') end++;
+    uint64_t offset = start;
+    for (int i=0; i<8; ++i) bytes_push(&offsets, offset >> (i*8));
+
+    for (size_t i=start; i+2<end; ++i) {
+      uint32_t t = trigram(&data[i]);
+      if (slot_of[t] == 0) {
+        if (slots_len == slots_cap) {
+          slots_cap = slots_cap == 0 ? 1024 : slots_cap * 2;
+          slots = realloc(slots, slots_cap * sizeof(Slot));
+        }
+        slots[slots_len++] = (Slot) {0};
+        slot_of[t] = slots_len;
+      }
+      Slot* slot = &slots[slot_of[t] - 1];
+      if (slot->last == block + 1) continue;
+      varint_push(&slot->postings, block + 1 - slot->last);
+      slot->last = block + 1;
+      slot->count++;
+    }
+    start = end;
+  }
+  for (int i=0; i<8; ++i) bytes_push(&offsets, (uint64_t) size >> (i*8));
+
+  char index_path[4096], tmp_path[4200];
+  snprintf(index_path, sizeof(index_path), "%s.tri", path);
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d", index_path, getpid());
+  FILE* f = fopen(tmp_path, "wb");
+  bool ok = f != NULL;
+  if (!ok) perror(tmp_path);
+
+  uint64_t postings_offset = 0;
+  if (ok) {
+    IndexHeader header = { INDEX_MAGIC, INDEX_VERSION, size, mtime_ns(&st), block, slots_len };
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(offsets.data, 1, offsets.len, f);
+    for (uint32_t t=0; t<(1 << 24); ++t) {
+      if (slot_of[t] == 0) continue;
+      Slot* slot = &slots[slot_of[t] - 1];
+      IndexEntry entry = { t, slot->count, postings_offset };
+      fwrite(&entry, sizeof(entry), 1, f);
+      postings_offset += slot->postings.len;
+    }
+    for (uint32_t t=0; t<(1 << 24); ++t) {
+      if (slot_of[t] == 0) continue;
+      Slot* slot = &slots[slot_of[t] - 1];
+      fwrite(slot->postings.data, 1, slot->postings.len, f);
+    }
+    ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp_path, index_path) < 0) {
+      perror(index_path);
+      unlink(tmp_path);
+      ok = false;
+    }
+  }
+
+  if (ok) {
+    printf("%s: %llu blocks, %zu trigrams, %llu bytes of postings\n", index_path,
+      (unsigned long long) block, slots_len, (unsigned long long) postings_offset);
+  }
+  for (size_t i=0; i<slots_len; ++i) free(slots[i].postings.data);
+  free(slots);
+  free(slot_of);
+  free(offsets.data);
+  if (data != NULL) munmap(data, size);
+  return ok ? 0 : 1;
+}
+
+typedef struct {
+  uint8_t* base;
+  size_t size;
+  IndexHeader* header;
+  uint64_t* offsets;
+  IndexEntry* entries;
+  uint8_t* postings;
+  uint8_t* end;
+} Index;
+
+// the parts of an index that don't need decoding are checked once,
+// when it's opened: block offsets that go up to the end of the file,
+// and entries sorted by trigram that point into the postings.
+// the postings are checked as they are decoded, by index_candidates
+bool index_valid(Index* idx) {
+  IndexHeader* h = idx->header;
+  for (uint64_t i=0; i<h->block_count; ++i) {
+    if (idx->offsets[i] > idx->offsets[i+1]) return false;
+  }
+  if (idx->offsets[0] != 0 || idx->offsets[h->block_count] != h->file_size) return false;
+
+  size_t postings_len = idx->end - idx->postings;
+  for (uint64_t i=0; i<h->trigram_count; ++i) {
+    IndexEntry* e = &idx->entries[i];
+    if (e->offset >= postings_len || e->count == 0 || e->count > h->block_count) return false;
+    if (i > 0 && e->trigram <= idx->entries[i-1].trigram) return false;
+  }
+  return true;
+}
+
+// maps the index of path, if there is one and it's up to date
+bool index_open(char* path, struct stat* file, Index* idx) {
+  char index_path[4096];
+  snprintf(index_path, sizeof(index_path), "%s.tri", path);
+  struct stat st;
+  idx->base = (uint8_t*) map_file(index_path, &idx->size, &st);
+  if (idx->base == NULL) return false;
+
+  IndexHeader* h = idx->header = (IndexHeader*) idx->base;
+  bool ok = idx->size >= sizeof(IndexHeader)
+    && memcmp(h->magic, INDEX_MAGIC, 4) == 0
+    && h->version == INDEX_VERSION
+    // each count is bounded first, so the sizes can't overflow
+    && h->block_count < idx->size / 8
+    && h->trigram_count < idx->size / sizeof(IndexEntry)
+    && idx->size >= sizeof(IndexHeader) + (h->block_count + 1) * 8 + h->trigram_count * sizeof(IndexEntry);
+  if (ok && (h->file_size != (uint64_t) file->st_size || h->file_mtime != mtime_ns(file))) {
+    fprintf(stderr, "%s is out of date, searching the whole file\n", index_path);
+    ok = false;
+  } else {
+    if (ok) {
+      idx->offsets = (uint64_t*) (idx->base + sizeof(IndexHeader));
+      idx->entries = (IndexEntry*) (idx->offsets + h->block_count + 1);
+      idx->postings = (uint8_t*) (idx->entries + h->trigram_count);
+      idx->end = idx->base + idx->size;
+      ok = index_valid(idx);
+    }
+    if (!ok) fprintf(stderr, "%s is corrupt, searching the whole file\n", index_path);
+  }
+  if (!ok) {
+    munmap(idx->base, idx->size);
+    return false;
+  }
+  return true;
+}
+
+IndexEntry* index_find(Index* idx, uint32_t t) {
+  size_t lo = 0, hi = idx->header->trigram_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (idx->entries[mid].trigram < t) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo < idx->header->trigram_count && idx->entries[lo].trigram == t) return &idx->entries[lo];
+  return NULL;
+}
+
+// the next block of a posting list, which has to come after the last one
+// and be in the file. block is the last block plus one, like in index_build
+bool posting_next(Index* idx, const uint8_t** p, uint64_t* block) {
+  uint64_t delta;
+  if (!varint_read(p, idx->end, &delta) || delta == 0) return false;
+  *block += delta;
+  return *block >= delta && *block <= idx->header->block_count;
+}
+
+// the blocks that have every trigram of the query, in order, in out
+// and count. the shortest posting list is decoded first, the others only
+// filter it. false if a posting list is corrupt: nothing is searched then
+bool index_candidates(Index* idx, char* query, uint64_t** out, size_t* count_out) {
+  size_t len = strlen(query);
+  IndexEntry* entries[len];
+  size_t n = 0;
+  *out = NULL;
+  *count_out = 0;
+  for (size_t i=0; i+2<len; ++i) {
+    IndexEntry* e = index_find(idx, trigram((uint8_t*) &query[i]));
+    if (e == NULL) return true;
+    entries[n++] = e;
+    if (e->count < entries[0]->count) {
+      entries[n-1] = entries[0];
+      entries[0] = e;
+    }
+  }
+
+  uint64_t* blocks = malloc(entries[0]->count * sizeof(uint64_t));
+  const uint8_t* p = idx->postings + entries[0]->offset;
+  uint64_t block = 0;
+  for (uint32_t i=0; i<entries[0]->count; ++i) {
+    if (!posting_next(idx, &p, &block)) {
+      free(blocks);
+      return false;
+    }
+    blocks[i] = block - 1;
+  }
+  size_t count = entries[0]->count;
+
+  for (size_t j=1; j<n && count > 0; ++j) {
+    p = idx->postings + entries[j]->offset;
+    block = 0;
+    size_t kept = 0, i = 0;
+    for (uint32_t left=entries[j]->count; left > 0 && i < count; --left) {
+      if (!posting_next(idx, &p, &block)) {
+        free(blocks);
+        return false;
+      }
+      while (i < count && blocks[i] < block - 1) i++;
+      if (i < count && blocks[i] == block - 1) blocks[kept++] = blocks[i++];
+    }
+    count = kept;
+  }
+
+  *out = blocks;
+  *count_out = count;
+  return true;
+}
+
+// greps only the blocks the index allows. a block is copied out
+// to be terminated, like file_read_to_string does for the whole file
+bool grep_indexed(char* path, char* query, str query_str) {
+  uint64_t start = stats.on ? now_ns() : 0;
+  size_t size;
+  struct stat st;
+  char* data = map_file(path, &size, &st);
+  if (data == NULL || strlen(query) < 3) {
+    if (data != NULL) munmap(data, size);
+    return false;
+  }
+  Index idx;
+  if (!index_open(path, &st, &idx)) {
+    munmap(data, size);
+    return false;
+  }
+
+  uint64_t* blocks;
+  size_t count;
+  if (!index_candidates(&idx, query, &blocks, &count)) {
+    fprintf(stderr, "%s.tri is corrupt, searching the whole file\n", path);
+    munmap(idx.base, idx.size);
+    munmap(data, size);
+    return false;
+  }
+  stats.path = "index";
+  stats.blocks = idx.header->block_count;
+  stats.blocks_searched = count;
+  if (stats.on) stats.load_ns += now_ns() - start;
+
+  char* buf = NULL;
+  size_t cap = 0;
+  for (size_t i=0; i<count; ++i) {
+    uint64_t copy_start = stats.on ? now_ns() : 0;
+    uint64_t start = idx.offsets[blocks[i]];
+    uint64_t end = idx.offsets[blocks[i] + 1];
+    if (end - start + 1 > cap) {
+      cap = end - start + 1;
+      buf = realloc(buf, cap);
+    }
+    memcpy(buf, data + start, end - start);
+    buf[end - start] = 0;
+    stats.bytes += end - start;
+    if (stats.on) stats.load_ns += now_ns() - copy_start;
+    grep_text(buf, query_str);
+  }
+
+  free(buf);
+  free(blocks);
+  munmap(idx.base, idx.size);
+  munmap(data, size);
+  return true;
+}
+
+bool is_gzip(char* path) {
+  unsigned char magic[2] = {0};
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) return false;
+  size_t n = fread(magic, 1, 2, f);
+  fclose(f);
+  return n == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+// gzip files are inflated by a thread of their own, into two chunks
+// that take turns: while one is searched the other is being filled.
+// a chunk always ends on a newline, the start of the next line is
+// carried over to the next chunk. the chunks are reused, and only grow
+// for a line longer than CHUNK_SIZE
+#define CHUNK_SIZE (1024 * 1024)
+#define INPUT_SIZE (64 * 1024)
+
+typedef struct {
+  char* data;
+  size_t len, cap;
+  bool ready;
+} Chunk;
+
+typedef struct {
+  FILE* file;
+  Chunk chunks[2];
+  bool done;
+  char* error;
+  char* warning;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} Inflater;
+
+// hands a filled chunk to the search and waits for the other one
+Chunk* inflater_swap(Inflater* inf, int* current) {
+  Chunk* chunk = &inf->chunks[*current];
+  chunk->data[chunk->len] = 0;
+  pthread_mutex_lock(&inf->lock);
+  chunk->ready = true;
+  pthread_cond_broadcast(&inf->changed);
+  *current = 1 - *current;
+  while (inf->chunks[*current].ready) pthread_cond_wait(&inf->changed, &inf->lock);
+  pthread_mutex_unlock(&inf->lock);
+  return &inf->chunks[*current];
+}
+
+// after a member ends, tells if another one follows in the input.
+// if not, the rest of the file is ignored like gzip does, and the
+// warning says if it was padding or garbage
+bool next_member(Inflater* inf, z_stream* z, unsigned char* input) {
+  // the magic may be split between two reads
+  if (z->avail_in < 2) {
+    memmove(input, z->next_in, z->avail_in);
+    z->next_in = input;
+    size_t n = fread(input + z->avail_in, 1, INPUT_SIZE - z->avail_in, inf->file);
+    z->avail_in += n;
+    stats.compressed_bytes += n;
+  }
+  if (z->avail_in == 0) return false;
+  if (z->avail_in >= 2 && z->next_in[0] == 0x1f && z->next_in[1] == 0x8b) return true;
+
+  bool zeros = true;
+  while (zeros && z->avail_in > 0) {
+    for (size_t i=0; i<z->avail_in && zeros; ++i) zeros = z->next_in[i] == 0;
+    z->next_in = input;
+    z->avail_in = fread(input, 1, INPUT_SIZE, inf->file);
+    stats.compressed_bytes += z->avail_in;
+  }
+  inf->warning = zeros ? "decompression OK, trailing zero bytes ignored"
+                       : "decompression OK, trailing garbage ignored";
+  return false;
+}
+
+void* inflater_run(void* arg) {
+  Inflater* inf = arg;
+  unsigned char* input = malloc(INPUT_SIZE);
+  z_stream z = {0};
+  // 15 + 32: the largest window, and a gzip or zlib header
+  if (inflateInit2(&z, 15 + 32) != Z_OK) {
+    inf->error = z.msg != NULL ? z.msg : "can't start inflating";
+  }
+
+  int current = 0;
+  Chunk* chunk = &inf->chunks[current];
+  char* carry = NULL;
+  size_t carry_cap = 0;
+  int ret = Z_OK;
+  while (inf->error == NULL) {
+    uint64_t start = stats.on ? now_ns() : 0;
+    if (z.avail_in == 0) {
+      z.avail_in = fread(input, 1, INPUT_SIZE, inf->file);
+      z.next_in = input;
+      stats.compressed_bytes += z.avail_in;
+      if (z.avail_in == 0) break;
+    }
+
+    // one byte is kept for the terminator grep_text needs
+    if (chunk->cap - chunk->len < 2) {
+      chunk->cap *= 2;
+      chunk->data = realloc(chunk->data, chunk->cap);
+    }
+    z.next_out = (unsigned char*) chunk->data + chunk->len;
+    z.avail_out = chunk->cap - chunk->len - 1;
+    ret = inflate(&z, Z_NO_FLUSH);
+    chunk->len = chunk->cap - 1 - z.avail_out;
+    if (stats.on) stats.inflate_ns += now_ns() - start;
+    if (ret == Z_STREAM_END) {
+      // concatenated gzip files are one stream each
+      if (!next_member(inf, &z, input)) break;
+      inflateReset(&z);
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      inf->error = z.msg != NULL ? z.msg : "corrupt data";
+      break;
+    }
+
+    if (chunk->len + 1 < chunk->cap) continue;
+    size_t full = chunk->len;
+    while (full > 0 && chunk->data[full-1] != '\n') full--;
+    if (full == 0) continue;
+
+    // the part of the line after the last newline moves to the other
+    // chunk. it's set aside first: this one belongs to the search now
+    size_t carry_len = chunk->len - full;
+    if (carry_cap < carry_len) {
+      carry_cap = carry_len;
+      carry = realloc(carry, carry_cap);
+    }
+    memcpy(carry, chunk->data + full, carry_len);
+    chunk->len = full;
+    chunk = inflater_swap(inf, &current);
+    if (chunk->cap < carry_len + 2) {
+      chunk->cap = carry_len + CHUNK_SIZE;
+      chunk->data = realloc(chunk->data, chunk->cap);
+    }
+    memcpy(chunk->data, carry, carry_len);
+    chunk->len = carry_len;
+  }
+  if (inf->error == NULL && ret != Z_STREAM_END) inf->error = "unexpected end of file";
+
+  inflateEnd(&z);
+  free(carry);
+  free(input);
+  // the last chunk goes out as it is, then the search is told to stop
+  inflater_swap(inf, &current);
+  pthread_mutex_lock(&inf->lock);
+  inf->done = true;
+  pthread_cond_broadcast(&inf->changed);
+  pthread_mutex_unlock(&inf->lock);
+  return NULL;
+}
+
+int grep_gzip(char* path, str query_str) {
+  Inflater inf = {0};
+  inf.file = fopen(path, "rb");
+  if (inf.file == NULL) {
+    perror(path);
+    return 1;
+  }
+  for (int i=0; i<2; ++i) {
+    inf.chunks[i].cap = CHUNK_SIZE;
+    inf.chunks[i].data = malloc(CHUNK_SIZE);
+  }
+  pthread_mutex_init(&inf.lock, NULL);
+  pthread_cond_init(&inf.changed, NULL);
+  pthread_t thread;
+  int err = pthread_create(&thread, NULL, inflater_run, &inf);
+  if (err != 0) inf.error = strerror(err);
+
+  for (int current=0; err == 0; current = 1 - current) {
+    Chunk* chunk = &inf.chunks[current];
+    pthread_mutex_lock(&inf.lock);
+    while (!chunk->ready && !inf.done) pthread_cond_wait(&inf.changed, &inf.lock);
+    bool ready = chunk->ready;
+    pthread_mutex_unlock(&inf.lock);
+    if (!ready) break;
+
+    stats.bytes += chunk->len;
+    grep_text(chunk->data, query_str);
+
+    pthread_mutex_lock(&inf.lock);
+    chunk->ready = false;
+    chunk->len = 0;
+    pthread_cond_broadcast(&inf.changed);
+    pthread_mutex_unlock(&inf.lock);
+  }
+
+  if (err == 0) pthread_join(thread, NULL);
+  fclose(inf.file);
+  for (int i=0; i<2; ++i) free(inf.chunks[i].data);
+  pthread_mutex_destroy(&inf.lock);
+  pthread_cond_destroy(&inf.changed);
+  if (inf.error != NULL) {
+    fprintf(stderr, "%s: %s\n", path, inf.error);
+    return 1;
+  }
+  if (inf.warning != NULL) fprintf(stderr, "%s: %s\n", path, inf.warning);
+  return 0;
+}
+
+// --bench: generated corpora of different shapes, searched for queries
+// of different length, selectivity and case. every search runs a few
+// times through grep_text, and through a plain memmem loop as the
+// baseline: memmem over the whole buffer, skipping to the next line
+// after a hit, with no lowercasing and no output.
+// the output of grep_text goes to /dev/null
+uint64_t bench_rand(uint64_t* state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1d;
+}
+
+void bytes_append(Bytes* b, const char* s) {
+  for (; *s; ++s) bytes_push(b, *s);
+}
+
+char* BENCH_WORDS[] = {
+  "request", "served", "connection", "reset", "by", "peer", "timeout", "retrying",
+  "cache", "miss", "hit", "user", "session", "opened", "closed", "disk", "full",
+  "error", "warning", "slow", "query", "took", "ms", "upstream", "returned",
+};
+#define BENCH_WORDS_COUNT (sizeof(BENCH_WORDS) / sizeof(char*))
+
+char* BENCH_LEVELS[] = { "INFO", "WARN", "ERROR", "DEBUG" };
+
+// short log lines, around 80 bytes. the words are picked one by one,
+// so a long query would never match: one line in BENCH_PHRASE_EVERY
+// ends with a whole phrase instead
+#define BENCH_PHRASE_EVERY 16
+
+void bench_log_line(Bytes* out, uint64_t* rng) {
+  char head[64];
+  uint64_t r = bench_rand(rng);
+  snprintf(head, sizeof(head), "2024-%02d-%02d %02d:%02d:%02d %-5s [%u] ",
+    (int) (r % 12 + 1), (int) (r / 12 % 28 + 1), (int) (r / 336 % 24), (int) (r / 8064 % 60),
+    (int) (r / 483840 % 60), BENCH_LEVELS[r >> 62], (unsigned) (r >> 40 & 0xffff));
+  bytes_append(out, head);
+  int words = bench_rand(rng) % 6 + 3;
+  for (int i=0; i<words; ++i) {
+    if (i > 0) bytes_push(out, ' ');
+    bytes_append(out, BENCH_WORDS[bench_rand(rng) % BENCH_WORDS_COUNT]);
+  }
+  if (bench_rand(rng) % BENCH_PHRASE_EVERY == 0) bytes_append(out, ": connection reset by peer");
+}
+
+void bench_log(Bytes* out, size_t size, uint64_t* rng) {
+  while (out->len < size) {
+    bench_log_line(out, rng);
+    bytes_push(out, '\n');
+  }
+}
+
+// the same lines, every one with an error in it
+void bench_every(Bytes* out, size_t size, uint64_t* rng) {
+  while (out->len < size) {
+    bench_log_line(out, rng);
+    bytes_append(out, " error\n");
+  }
+}
+
+// minified json, a newline every 100 KB or so
+void bench_minified(Bytes* out, size_t size, uint64_t* rng) {
+  char item[128];
+  while (out->len < size) {
+    for (size_t line=out->len; out->len - line < 100000; ) {
+      uint64_t r = bench_rand(rng);
+      snprintf(item, sizeof(item), "{\"id\":%u,\"name\":\"%s_%s\",\"ok\":%s},",
+        (unsigned) (r & 0xffffff), BENCH_WORDS[(r >> 24) % BENCH_WORDS_COUNT],
+        BENCH_WORDS[(r >> 32) % BENCH_WORDS_COUNT], r >> 63 ? "true" : "false");
+      bytes_append(out, item);
+    }
+    bytes_push(out, '\n');
+  }
+}
+
+char* BENCH_UNICODE[] = {
+  "café", "naïve", "straße", "東京", "данные", "ώρα", "日本語", "señal", "größe",
+  "ошибка", "エラー", "déjà", "vu", "error", "timeout", "🎉", "façade", "Ärger",
+};
+
+// utf-8 text, lines of a few words
+void bench_unicode(Bytes* out, size_t size, uint64_t* rng) {
+  while (out->len < size) {
+    int words = bench_rand(rng) % 10 + 5;
+    for (int i=0; i<words; ++i) {
+      if (i > 0) bytes_push(out, ' ');
+      bytes_append(out, BENCH_UNICODE[bench_rand(rng) % (sizeof(BENCH_UNICODE) / sizeof(char*))]);
+    }
+    bytes_push(out, '\n');
+  }
+}
+
+// random bytes. there are no zeros, grep_text stops at the first one
+void bench_binary(Bytes* out, size_t size, uint64_t* rng) {
+  while (out->len < size) {
+    uint64_t r = bench_rand(rng);
+    for (int i=0; i<8; ++i) {
+      uint8_t byte = r >> (i*8);
+      bytes_push(out, byte == 0 ? 1 : byte);
+    }
+  }
+}
+
+typedef struct {
+  char* name;
+  void (*generate)(Bytes* out, size_t size, uint64_t* rng);
+} BenchCorpus;
+
+const BenchCorpus BENCH_CORPORA[] = {
+  { "log",      bench_log },
+  { "minified", bench_minified },
+  { "unicode",  bench_unicode },
+  { "binary",   bench_binary },
+  { "every",    bench_every },
+};
+
+// from very common to absent, and an uppercase one:
+// lines are lowercased but the query isn't, so it never matches
+char* BENCH_QUERIES[] = {
+  "e", "er", "error", "timeout", "connection reset by peer", "ERROR", "café", "zqxjv",
+};
+
+uint64_t memmem_lines(char* data, size_t len, char* query) {
+  size_t qlen = strlen(query);
+  char* end = data + len;
+  uint64_t hits = 0;
+  for (char* p = data; p < end; ) {
+    char* found = memmem(p, end - p, query, qlen);
+    if (found == NULL) break;
+    hits++;
+    char* newline = memchr(found, '\n', end - found);
+    if (newline == NULL) break;
+    p = newline + 1;
+  }
+  return hits;
+}
+
+void mean_sd(double* xs, int n, double* mean, double* sd) {
+  double sum = 0, sq = 0;
+  for (int i=0; i<n; ++i) sum += xs[i];
+  *mean = sum / n;
+  for (int i=0; i<n; ++i) sq += (xs[i] - *mean) * (xs[i] - *mean);
+  *sd = n > 1 ? sqrt(sq / (n - 1)) : 0;
+}
+
+int bench(size_t size, int runs) {
+  printf("%-9s %-26s %16s %16s %7s %9s %6s %9s\n", "corpus", "query",
+    "grep GB/s", "memmem GB/s", "ratio", "hits", "hit%", "memmem");
+  fflush(stdout);
+  int saved_stdout = dup(1);
+  int null = open("/dev/null", O_WRONLY);
+  double grep_gbps[runs], memmem_gbps[runs];
+
+  for (size_t c=0; c<sizeof(BENCH_CORPORA)/sizeof(BenchCorpus); ++c) {
+    uint64_t rng = 0x9e3779b97f4a7c15 + c;
+    Bytes text = {0};
+    BENCH_CORPORA[c].generate(&text, size, &rng);
+    bytes_push(&text, 0);
+    text.len--;
+
+    for (size_t q=0; q<sizeof(BENCH_QUERIES)/sizeof(char*); ++q) {
+      char* query = BENCH_QUERIES[q];
+      str query_str = str_from_cstr(query);
+      uint64_t hits = 0, lines = 0, memmem_hits = 0;
+
+      for (int r=0; r<runs; ++r) {
+        stats = (Stats) { .on = true };
+        dup2(null, 1);
+        uint64_t start = now_ns();
+        grep_text((char*) text.data, query_str);
+        fflush(stdout);
+        uint64_t elapsed = now_ns() - start;
+        dup2(saved_stdout, 1);
+        grep_gbps[r] = (double) text.len / elapsed;
+        hits = stats.matches;
+        lines = stats.lines;
+
+        start = now_ns();
+        memmem_hits = memmem_lines((char*) text.data, text.len, query);
+        memmem_gbps[r] = (double) text.len / (now_ns() - start);
+      }
+
+      double gm, gsd, mm, msd;
+      mean_sd(grep_gbps, runs, &gm, &gsd);
+      mean_sd(memmem_gbps, runs, &mm, &msd);
+      printf("%-9s %-26s %8.3f ±%6.3f %8.3f ±%6.3f %6.1fx %9llu %5.1f%% %9llu\n",
+        BENCH_CORPORA[c].name, query, gm, gsd, mm, msd, mm / gm, (unsigned long long) hits,
+        lines > 0 ? 100.0 * hits / lines : 0, (unsigned long long) memmem_hits);
+      fflush(stdout);
+    }
+    free(text.data);
+  }
+
+  close(null);
+  close(saved_stdout);
+  stats = (Stats) {0};
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    int mb = argc > 2 ? atoi(argv[2]) : 8;
+    int runs = argc > 3 ? atoi(argv[3]) : 5;
+    if (mb < 1 || runs < 1) {
+      fprintf(stderr, "usage: %s --bench [size in MB] [runs], both at least 1\n", argv[0]);
+      return 1;
+    }
+    return bench((size_t) mb * 1024 * 1024, runs);
+  }
+  // --stats prints the counters on stderr at the end
+  if (argc > 1 && strcmp(argv[1], "--stats") == 0) {
+    stats.on = true;
+    argv++;
+    argc--;
+  }
+  if (argc < 3) {
+    printf("Missing args\n");
+    return 0;
+  }
+  if (strcmp(argv[1], "--index") == 0) {
+    if (is_gzip(argv[2])) {
+      fprintf(stderr, "%s: compressed files can't be indexed\n", argv[2]);
+      return 1;
+    }
+    return index_build(argv[2]);
+  }
+
+  char* query = argv[1];
+  char* path  = argv[2];
+  str query_str = str_from_cstr(query);
+  uint64_t start = now_ns();
+  int result = 0;
+
+  // gzip is found by its magic bytes, whatever the name of the file
+  if (is_gzip(path)) {
+    stats.path = "gzip";
+    result = grep_gzip(path, query_str);
+  // with an up to date index, only the candidate blocks are read
+  } else if (!grep_indexed(path, query, query_str)) {
+    stats.path = "scan";
+    char* contents = file_read_to_string(path);
+    if (contents == NULL) return 0;
+    if (stats.on) {
+      stats.load_ns = now_ns() - start;
+      stats.bytes = strlen(contents);
+    }
+
+    grep_text(contents, query_str);
+    free(contents);
+  }
+
+  if (stats.on) {
+    uint64_t t = now_ns();
+    fflush(stdout);
+    stats.flush_ns = now_ns() - t;
+    stats_print(now_ns() - start);
+  }
+  return result;
 }
\ No newline at end of file
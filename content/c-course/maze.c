@@ -2,30 +2,19 @@
 #include <stdlib.h>
 #include <time.h>
 #include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 // https://nullprogram.com/blog/2014/06/22/
 
-typedef enum {
-  None = 0,
-  VertLeft = 185,
-  Vert = 186,
-  LeftDown = 187,
-  LeftUp = 188,
-  RightUp = 200,
-  RightDown = 201,
-  HoriUp = 202,
-  HoriDown = 203,
-  VertRight = 204,
-  Hori = 205,
-  Cross = 206,
-  Empty = 255,
-} CellSym;
-
-typedef struct {
-  bool left, right, down, up;
-  bool visited;
-} CellNode;
-
 const int DIRECTIONS[][2] = {
   {-1, 0}, // left
   {1, 0},  // right
@@ -33,51 +22,1027 @@ const int DIRECTIONS[][2] = {
   {0, -1}  // up
 };
 
-void dfs(CellNode maze[][32], int w, int h, int x, int y) {
-  CellNode* curr = &maze[y][x];
+// every cell keeps two bits: the passage to its right and the one below it.
+// left and up are the right and down bits of the neighbours, so every wall
+// is stored once. cells are packed four per byte, and rows are padded to
+// whole bytes so each row starts on its own byte
+#define OPEN_RIGHT 1
+#define OPEN_DOWN 2
+
+typedef struct {
+  int w, h;
+  size_t stride;
+  uint8_t* bits;
+  // length of the file mapping the bits are in, 0 if they are on the heap
+  size_t mapped;
+} Maze;
+
+Maze maze_new(int w, int h) {
+  size_t stride = ((size_t) w + 3) / 4;
+  Maze m = { .w = w, .h = h, .stride = stride, .bits = calloc(stride * h, 1) };
+  if (m.bits == NULL) {
+    fprintf(stderr, "can't allocate a %dx%d maze\n", w, h);
+    exit(1);
+  }
+  return m;
+}
+
+// OPEN_RIGHT and OPEN_DOWN bits of a cell in a packed row
+int row_get(uint8_t* row, int x) {
+  return (row[x/4] >> (x%4 * 2)) & 3;
+}
+
+// the maze file: a fixed header, then the rows of bits exactly as they
+// are in memory. loading maps the file and points the maze at the bits,
+// so nothing is parsed and only the pages that are used are read.
+// numbers are in the byte order of the machine: a file from a big endian
+// one reads as a different version, and is refused
+#define MAZE_MAGIC "MAZE"
+#define MAZE_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t w, h;
+  uint64_t seed;
+  uint64_t stride;
+} MazeHeader;
+
+void maze_free(Maze* m) {
+  if (m->mapped > 0) {
+    munmap(m->bits - sizeof(MazeHeader), m->mapped);
+  } else {
+    free(m->bits);
+  }
+}
+
+size_t maze_bytes(Maze* m) {
+  return m->stride * m->h;
+}
+
+MazeHeader maze_header(int w, int h, uint64_t seed) {
+  MazeHeader header = { MAZE_MAGIC, MAZE_VERSION, w, h, seed, ((size_t) w + 3) / 4 };
+  return header;
+}
+
+bool maze_save(Maze* m, uint64_t seed, FILE* out) {
+  MazeHeader header = maze_header(m->w, m->h, seed);
+  fwrite(&header, sizeof(header), 1, out);
+  fwrite(m->bits, 1, maze_bytes(m), out);
+  return fflush(out) == 0 && !ferror(out);
+}
+
+// maps a maze file. the mapping is private, so the maze can be changed
+// in memory without writing to the file
+bool maze_map(int fd, char* name, Maze* m, uint64_t* seed) {
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(MazeHeader)) {
+    fprintf(stderr, "%s: not a maze file\n", name);
+    return false;
+  }
+  uint8_t* base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) {
+    perror(name);
+    return false;
+  }
+
+  MazeHeader* header = (MazeHeader*) base;
+  char* error = NULL;
+  if (memcmp(header->magic, MAZE_MAGIC, 4) != 0) {
+    error = "not a maze file";
+  } else if (header->version != MAZE_VERSION) {
+    error = "unknown version";
+  } else if (header->w == 0 || header->w > INT32_MAX || header->h == 0 || header->h > INT32_MAX
+      || header->stride != ((size_t) header->w + 3) / 4) {
+    error = "bad dimensions";
+  } else if ((size_t) st.st_size - sizeof(MazeHeader) < header->stride * header->h) {
+    error = "truncated";
+  } else {
+    // no passage may lead out of the grid. this reads a byte of every
+    // row, but the rest of the cells are still only read when used
+    uint8_t* bits = base + sizeof(MazeHeader);
+    int w = header->w, h = header->h;
+    for (int y=0; y<h && error == NULL; ++y) {
+      if (row_get(&bits[y * header->stride], w-1) & OPEN_RIGHT) error = "bad walls";
+    }
+    for (int x=0; x<w && error == NULL; ++x) {
+      if (row_get(&bits[(size_t) (h-1) * header->stride], x) & OPEN_DOWN) error = "bad walls";
+    }
+  }
+  if (error != NULL) {
+    fprintf(stderr, "%s: %s\n", name, error);
+    munmap(base, st.st_size);
+    return false;
+  }
+
+  *m = (Maze) { header->w, header->h, header->stride, base + sizeof(MazeHeader), st.st_size };
+  *seed = header->seed;
+  return true;
+}
+
+bool maze_load(char* path, Maze* m, uint64_t* seed) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return false;
+  }
+  // the mapping stays after the file is closed
+  bool ok = maze_map(fd, path, m, seed);
+  close(fd);
+  return ok;
+}
+
+void row_set(uint8_t* row, int x, int open) {
+  row[x/4] |= open << (x%4 * 2);
+}
+
+int maze_get(Maze* m, int x, int y) {
+  return row_get(&m->bits[y * m->stride], x);
+}
+
+void maze_set(Maze* m, int x, int y, int open) {
+  row_set(&m->bits[y * m->stride], x, open);
+}
+
+// removes the wall between a cell and its neighbour in direction d
+void maze_carve(Maze* m, int x, int y, int d) {
+  switch (d) {
+    case 0: maze_set(m, x-1, y, OPEN_RIGHT); break;
+    case 1: maze_set(m, x, y, OPEN_RIGHT); break;
+    case 2: maze_set(m, x, y, OPEN_DOWN); break;
+    case 3: maze_set(m, x, y-1, OPEN_DOWN); break;
+  }
+}
+
+// the passages of a cell in the lrdu order of the table below
+int maze_code(Maze* m, int x, int y) {
+  int open = maze_get(m, x, y);
+  int left = x > 0 && (maze_get(m, x-1, y) & OPEN_RIGHT);
+  int up = y > 0 && (maze_get(m, x, y-1) & OPEN_DOWN);
+  return (left << 3)
+    | ((open & OPEN_RIGHT) << 2)
+    | ((open & OPEN_DOWN) ? 2 : 0)
+    | (up << 0);
+}
+
+// one bit per cell, rows padded to whole bytes like the maze
+typedef struct {
+  size_t stride;
+  uint8_t* bits;
+} Bitmap;
+
+Bitmap bitmap_new(int w, int h) {
+  size_t stride = ((size_t) w + 7) / 8;
+  return (Bitmap) { stride, calloc(stride * h, 1) };
+}
+
+bool bitmap_get(Bitmap* b, int x, int y) {
+  return b->bits[y * b->stride + x/8] & (1 << x%8);
+}
+
+void bitmap_set(Bitmap* b, int x, int y) {
+  b->bits[y * b->stride + x/8] |= 1 << x%8;
+}
+
+// xoshiro256** (https://prng.di.unimi.it/), seeded through splitmix64.
+// every generator takes its own state, so a seed gives the same maze
+// everywhere and threads don't share anything. most choices only need
+// a few bits, so they are taken from a buffered 64 bit word
+typedef struct {
+  uint64_t s[4];
+  uint64_t buf;
+  int buf_bits;
+  // 64 bit words drawn, for the benchmarks
+  uint64_t words;
+} Rng;
+
+uint64_t splitmix64(uint64_t* x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+// independent sequences for the same seed, one per stream
+Rng rng_new(uint64_t seed, uint64_t stream) {
+  Rng r = {0};
+  uint64_t x = stream;
+  uint64_t mix = splitmix64(&x);
+  x = seed ^ mix;
+  for (int i=0; i<4; ++i) r.s[i] = splitmix64(&x);
+  return r;
+}
+
+uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+uint64_t rng_next(Rng* r) {
+  uint64_t* s = r->s;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+  r->words++;
+  return result;
+}
+
+// n random bits, n <= 32
+uint32_t rng_bits(Rng* r, int n) {
+  if (r->buf_bits < n) {
+    r->buf = rng_next(r);
+    r->buf_bits = 64;
+  }
+  uint32_t v = r->buf & ((1ull << n) - 1);
+  r->buf >>= n;
+  r->buf_bits -= n;
+  return v;
+}
+
+// a number below n without the bias of rand() % n: Lemire's multiply
+// and shift, rejecting the few values that would make some results
+// more likely. small ranges only take 8 or 16 bits
+uint32_t rng_below(Rng* r, uint32_t n) {
+  int k = n <= 1 << 8 ? 8 : n <= 1 << 16 ? 16 : 32;
+  uint64_t mask = (1ull << k) - 1;
+  uint64_t m = (uint64_t) rng_bits(r, k) * n;
+  if ((m & mask) < n) {
+    uint64_t t = ((mask + 1) - n) % n;
+    while ((m & mask) < t) m = (uint64_t) rng_bits(r, k) * n;
+  }
+  return m >> k;
+}
+
+// the 24 orders of the four directions, two bits each, first one lowest
+const uint8_t PERMUTATIONS[24] = {
+  0xe4, 0xb4, 0xd8, 0x78, 0x9c, 0x6c, 0xe1, 0xb1, 0xc9, 0x39, 0x8d, 0x2d,
+  0xd2, 0x72, 0xc6, 0x36, 0x4e, 0x1e, 0x93, 0x63, 0x87, 0x27, 0x4b, 0x1b
+};
+
+// a rectangle of cells
+typedef struct {
+  int x, y, w, h;
+} Rect;
+
+// randomized depth first search, with an explicit stack of cell indices
+// instead of recursion: the path can be as long as the whole maze.
+// every cell gets its four directions shuffled once, when it's pushed.
+// from the cell on top of the stack it tries its next direction, carving
+// if it leads to an unvisited cell, and backtracks when none are left.
+// it stays inside rect, and only writes the bits of the cells in it
+void dfs_rect(Maze* maze, Rect rect, int x, int y, Rng* rng) {
+  size_t cap = 1024, len = 0;
+  uint32_t* stack = malloc(cap * sizeof(uint32_t));
+  // the directions left for every cell of the stack, two bits each,
+  // and how many there are in the high byte
+  uint16_t* order = malloc(cap * sizeof(uint16_t));
+  Bitmap visited = bitmap_new(rect.w, rect.h);
+
+  bitmap_set(&visited, x - rect.x, y - rect.y);
+  stack[len] = (uint32_t) (y - rect.y) * rect.w + (x - rect.x);
+  order[len++] = 4 << 8 | PERMUTATIONS[rng_below(rng, 24)];
+
+  while (len > 0) {
+    uint16_t left = order[len-1];
+    if (left >> 8 == 0) {
+      len--;
+      continue;
+    }
+    order[len-1] = ((left >> 8) - 1) << 8 | (left & 0xff) >> 2;
+
+    uint32_t idx = stack[len-1];
+    int cx = idx % rect.w;
+    int cy = idx / rect.w;
+    int d = left & 3;
+    int dx = cx + DIRECTIONS[d][0];
+    int dy = cy + DIRECTIONS[d][1];
+    if (dx < 0 || dx >= rect.w || dy < 0 || dy >= rect.h) continue;
+    if (bitmap_get(&visited, dx, dy)) continue;
+
+    maze_carve(maze, rect.x + cx, rect.y + cy, d);
+    bitmap_set(&visited, dx, dy);
+    if (len == cap) {
+      cap *= 2;
+      stack = realloc(stack, cap * sizeof(uint32_t));
+      order = realloc(order, cap * sizeof(uint16_t));
+    }
+    stack[len] = (uint32_t) dy * rect.w + dx;
+    order[len++] = 4 << 8 | PERMUTATIONS[rng_below(rng, 24)];
+  }
+
+  free(order);
+  free(stack);
+  free(visited.bits);
+}
+
+void dfs(Maze* maze, int x, int y, Rng* rng) {
+  dfs_rect(maze, (Rect) { 0, 0, maze->w, maze->h }, x, y, rng);
+}
+
+void gen_dfs(Maze* maze, Rng* rng) {
+  dfs(maze, 0, 0, rng);
+}
+
+uint32_t uf_find(uint32_t* parent, uint32_t i) {
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+// Kruskal: goes through all the walls in random order, and removes
+// the ones between cells that aren't connected yet. a union find over
+// the cells tells which ones are
+void gen_kruskal(Maze* maze, Rng* rng) {
+  int w = maze->w, h = maze->h;
+  size_t cells = (size_t) w * h;
+  uint32_t* parent = malloc(cells * sizeof(uint32_t));
+  for (size_t i=0; i<cells; ++i) parent[i] = i;
 
-  curr->visited = true;
-  bool tries[4] = {0};
-  int tries_count = 0;
+  // a wall is cell * 2 for the one on the right, cell * 2 + 1 below
+  size_t count = 0;
+  uint32_t* walls = malloc(cells * 2 * sizeof(uint32_t));
+  for (size_t i=0; i<cells; ++i) {
+    if (i % w != (size_t) w-1) walls[count++] = i * 2;
+    if (i / w != (size_t) h-1) walls[count++] = i * 2 + 1;
+  }
 
-  while (tries_count < 4) {
-    int d = rand() % 4;
-    if (!tries[d]) tries_count += 1;
-    tries[d] = true;
+  for (size_t i=count; i>1; --i) {
+    size_t j = rng_below(rng, i);
+    uint32_t tmp = walls[i-1];
+    walls[i-1] = walls[j];
+    walls[j] = tmp;
+  }
 
-    int dx =  x + DIRECTIONS[d][0];
-    int dy =  y + DIRECTIONS[d][1];
+  for (size_t i=0; i<count; ++i) {
+    uint32_t cell = walls[i] / 2;
+    bool down = walls[i] % 2;
+    uint32_t a = uf_find(parent, cell);
+    uint32_t b = uf_find(parent, down ? cell + w : cell + 1);
+    if (a == b) continue;
 
-    if (dx < 0 || dx >= w || dy < 0 || dy >= h) continue;
+    parent[a] = b;
+    maze_set(maze, cell % w, cell / w, down ? OPEN_DOWN : OPEN_RIGHT);
+  }
 
-    CellNode* next = &maze[dy][dx];
-    if (next->visited) continue;
+  free(walls);
+  free(parent);
+}
+
+void prim_add_frontier(Maze* maze, Bitmap* seen, uint32_t* frontier, size_t* len, int x, int y) {
+  for (int d=0; d<4; ++d) {
+    int dx = x + DIRECTIONS[d][0];
+    int dy = y + DIRECTIONS[d][1];
+    if (dx < 0 || dx >= maze->w || dy < 0 || dy >= maze->h) continue;
+    if (bitmap_get(seen, dx, dy)) continue;
+    bitmap_set(seen, dx, dy);
+    frontier[(*len)++] = (uint32_t) dy * maze->w + dx;
+  }
+}
+
+// Prim: grows the maze from a cell. the frontier holds the cells next
+// to the maze; a random one is taken and joined to a random neighbour
+// that is in the maze already. seen marks the cells in the maze or in
+// the frontier, so each cell enters the frontier once
+void gen_prim(Maze* maze, Rng* rng) {
+  Bitmap in_maze = bitmap_new(maze->w, maze->h);
+  Bitmap seen = bitmap_new(maze->w, maze->h);
+  uint32_t* frontier = malloc((size_t) maze->w * maze->h * sizeof(uint32_t));
+  size_t len = 0;
+
+  bitmap_set(&in_maze, 0, 0);
+  bitmap_set(&seen, 0, 0);
+  prim_add_frontier(maze, &seen, frontier, &len, 0, 0);
+
+  while (len > 0) {
+    size_t i = rng_below(rng, len);
+    uint32_t idx = frontier[i];
+    frontier[i] = frontier[--len];
+    int x = idx % maze->w;
+    int y = idx / maze->w;
+
+    int options[4];
+    int options_count = 0;
+    for (int d=0; d<4; ++d) {
+      int dx = x + DIRECTIONS[d][0];
+      int dy = y + DIRECTIONS[d][1];
+      if (dx < 0 || dx >= maze->w || dy < 0 || dy >= maze->h) continue;
+      if (bitmap_get(&in_maze, dx, dy)) options[options_count++] = d;
+    }
 
-    switch (d) {
-      case 0: {
-        curr->left = true;
-        next->right = true;
-        break;
+    maze_carve(maze, x, y, options[rng_below(rng, options_count)]);
+    bitmap_set(&in_maze, x, y);
+    prim_add_frontier(maze, &seen, frontier, &len, x, y);
+  }
+
+  free(frontier);
+  free(seen.bits);
+  free(in_maze.bits);
+}
+
+// a random direction that stays inside the maze
+int random_direction(Maze* maze, int x, int y, Rng* rng) {
+  int options[4];
+  int options_count = 0;
+  for (int d=0; d<4; ++d) {
+    int dx = x + DIRECTIONS[d][0];
+    int dy = y + DIRECTIONS[d][1];
+    if (dx >= 0 && dx < maze->w && dy >= 0 && dy < maze->h) options[options_count++] = d;
+  }
+  return options[rng_below(rng, options_count)];
+}
+
+// Wilson: from every cell not in the maze yet, walks at random until it
+// hits the maze. only the last direction taken from every cell is kept,
+// so the loops of the walk erase themselves. then the walk is followed
+// again from its start, carving. all spanning trees are equally likely
+void gen_wilson(Maze* maze, Rng* rng) {
+  int w = maze->w, h = maze->h;
+  Bitmap in_maze = bitmap_new(w, h);
+  uint8_t* dirs = malloc((size_t) w * h);
+
+  bitmap_set(&in_maze, rng_below(rng, w), rng_below(rng, h));
+
+  for (int sy=0; sy<h; ++sy) {
+    for (int sx=0; sx<w; ++sx) {
+      int x = sx, y = sy;
+      while (!bitmap_get(&in_maze, x, y)) {
+        int d = random_direction(maze, x, y, rng);
+        dirs[(size_t) y * w + x] = d;
+        x += DIRECTIONS[d][0];
+        y += DIRECTIONS[d][1];
+      }
+
+      x = sx, y = sy;
+      while (!bitmap_get(&in_maze, x, y)) {
+        int d = dirs[(size_t) y * w + x];
+        maze_carve(maze, x, y, d);
+        bitmap_set(&in_maze, x, y);
+        x += DIRECTIONS[d][0];
+        y += DIRECTIONS[d][1];
       }
-      case 1: {
-        curr->right = true;
-        next->left = true;
-        break;
+    }
+  }
+
+  free(dirs);
+  free(in_maze.bits);
+}
+
+// Eller's algorithm builds the maze one row at a time. it only knows the
+// set of every cell of the current row: cells in the same set are already
+// connected through the rows above. sets are numbered below w, so all the
+// state is a few arrays w long
+typedef struct {
+  int w;
+  int next_set;
+  // set of every cell, -1 if it has none yet
+  int* sets;
+  // union find over the sets, for the joins along the row
+  int* parent;
+  // cells of every set met so far, and the one picked to go down
+  int* count;
+  int* pick;
+  bool* has_down;
+  // numbering of the sets for the next row
+  int* renumber;
+} Eller;
+
+Eller eller_new(int w) {
+  Eller e = { .w = w };
+  e.sets = malloc(w * sizeof(int));
+  e.parent = malloc(w * sizeof(int));
+  e.count = malloc(w * sizeof(int));
+  e.pick = malloc(w * sizeof(int));
+  e.has_down = malloc(w * sizeof(bool));
+  e.renumber = malloc(w * sizeof(int));
+  for (int x=0; x<w; ++x) e.sets[x] = -1;
+  return e;
+}
+
+void eller_free(Eller* e) {
+  free(e->sets);
+  free(e->parent);
+  free(e->count);
+  free(e->pick);
+  free(e->has_down);
+  free(e->renumber);
+}
+
+int eller_find(Eller* e, int s) {
+  while (e->parent[s] != s) {
+    e->parent[s] = e->parent[e->parent[s]];
+    s = e->parent[s];
+  }
+  return s;
+}
+
+// writes the passages of the next row in row, packed like a maze row.
+// the last row joins all the sets that are left
+void eller_row(Eller* e, uint8_t* row, bool last, Rng* rng) {
+  int w = e->w;
+  memset(row, 0, ((size_t) w + 3) / 4);
+
+  for (int x=0; x<w; ++x) {
+    if (e->sets[x] < 0) e->sets[x] = e->next_set++;
+  }
+  for (int s=0; s<w; ++s) {
+    e->parent[s] = s;
+    e->count[s] = 0;
+    e->has_down[s] = false;
+  }
+
+  for (int x=0; x<w-1; ++x) {
+    int a = eller_find(e, e->sets[x]);
+    int b = eller_find(e, e->sets[x+1]);
+    if (a == b || (!last && rng_bits(rng, 1))) continue;
+    e->parent[b] = a;
+    row_set(row, x, OPEN_RIGHT);
+  }
+  if (last) return;
+
+  // every set goes down at least once: besides the random passages,
+  // one of its cells, picked with reservoir sampling, is kept in reserve
+  for (int x=0; x<w; ++x) {
+    int s = e->sets[x] = eller_find(e, e->sets[x]);
+    if (rng_below(rng, ++e->count[s]) == 0) e->pick[s] = x;
+    if (rng_bits(rng, 1)) {
+      row_set(row, x, OPEN_DOWN);
+      e->has_down[s] = true;
+    }
+  }
+  for (int x=0; x<w; ++x) {
+    int s = e->sets[x];
+    if (!e->has_down[s] && e->pick[s] == x) row_set(row, x, OPEN_DOWN);
+  }
+
+  // the cells below a passage keep the set, the others get a new one
+  for (int s=0; s<w; ++s) e->renumber[s] = -1;
+  e->next_set = 0;
+  for (int x=0; x<w; ++x) {
+    int s = e->sets[x];
+    if (!(row_get(row, x) & OPEN_DOWN)) {
+      e->sets[x] = -1;
+      continue;
+    }
+    if (e->renumber[s] < 0) e->renumber[s] = e->next_set++;
+    e->sets[x] = e->renumber[s];
+  }
+}
+
+void gen_eller(Maze* maze, Rng* rng) {
+  Eller e = eller_new(maze->w);
+  for (int y=0; y<maze->h; ++y) {
+    eller_row(&e, &maze->bits[y * maze->stride], y == maze->h-1, rng);
+  }
+  eller_free(&e);
+}
+
+// binary tree: every cell opens either right or down. the last row and
+// the last column are long corridors, and the paths lean towards them
+void gen_binary_tree(Maze* maze, Rng* rng) {
+  for (int y=0; y<maze->h; ++y) {
+    for (int x=0; x<maze->w; ++x) {
+      bool right = x < maze->w-1;
+      bool down = y < maze->h-1;
+      if (right && down) {
+        maze_set(maze, x, y, rng_bits(rng, 1) ? OPEN_RIGHT : OPEN_DOWN);
+      } else if (right) {
+        maze_set(maze, x, y, OPEN_RIGHT);
+      } else if (down) {
+        maze_set(maze, x, y, OPEN_DOWN);
       }
-      case 2: {
-        curr->down = true;
-        next->up = true;
-        break;
+    }
+  }
+}
+
+// sidewinder: every row is cut into runs of cells joined to the right,
+// and every run opens down from one of its cells. the last row is
+// a single corridor
+void gen_sidewinder(Maze* maze, Rng* rng) {
+  int w = maze->w, h = maze->h;
+  for (int y=0; y<h; ++y) {
+    int run_start = 0;
+    for (int x=0; x<w; ++x) {
+      if (y == h-1) {
+        if (x < w-1) maze_set(maze, x, y, OPEN_RIGHT);
+        continue;
       }
-      case 3: {
-        curr->up = true;
-        next->down = true;
-        break;
+
+      if (x < w-1 && rng_bits(rng, 1)) {
+        maze_set(maze, x, y, OPEN_RIGHT);
+        continue;
       }
+      maze_set(maze, run_start + rng_below(rng, x - run_start + 1), y, OPEN_DOWN);
+      run_start = x + 1;
     }
+  }
+}
 
-    dfs(maze, w, h, dx, dy);
+typedef struct {
+  char* name;
+  void (*generate)(Maze* maze, Rng* rng);
+} Generator;
+
+const Generator GENERATORS[] = {
+  { "dfs",         gen_dfs },
+  { "kruskal",     gen_kruskal },
+  { "prim",        gen_prim },
+  { "wilson",      gen_wilson },
+  { "eller",       gen_eller },
+  { "binary-tree", gen_binary_tree },
+  { "sidewinder",  gen_sidewinder },
+};
+#define GENERATORS_COUNT (int) (sizeof(GENERATORS) / sizeof(Generator))
+
+const Generator* generator_find(char* name) {
+  for (int i=0; i<GENERATORS_COUNT; ++i) {
+    if (strcmp(GENERATORS[i].name, name) == 0) return &GENERATORS[i];
+  }
+  return NULL;
+}
+
+// the opposite of every direction
+const int OPPOSITE[] = { 1, 0, 3, 2 };
+
+// if there's a passage from a cell in direction d
+bool maze_open(Maze* m, int x, int y, int d) {
+  switch (d) {
+    case 0: return x > 0 && (maze_get(m, x-1, y) & OPEN_RIGHT);
+    case 1: return x < m->w - 1 && (maze_get(m, x, y) & OPEN_RIGHT);
+    case 2: return y < m->h - 1 && (maze_get(m, x, y) & OPEN_DOWN);
+    case 3: return y > 0 && (maze_get(m, x, y-1) & OPEN_DOWN);
+  }
+  return false;
+}
+
+// solvers go from the top left cell to the bottom right one. path marks
+// the cells on the way, that renderers can draw over the maze.
+// expanded counts the cells the solver had to look at
+typedef struct {
+  Bitmap path;
+  size_t length;
+  size_t expanded;
+} Solution;
+
+void solution_free(Solution* s) {
+  free(s->path.bits);
+}
+
+// parents are the direction back to the cell a cell was reached from
+#define NO_PARENT 0xff
+#define ROOT 0xfe
+
+Solution solution_from_parents(Maze* maze, uint8_t* parent, size_t expanded) {
+  Solution s = { bitmap_new(maze->w, maze->h), 0, expanded };
+  int x = maze->w-1, y = maze->h-1;
+  if (parent[(size_t) y * maze->w + x] == NO_PARENT) return s;
+
+  while (true) {
+    bitmap_set(&s.path, x, y);
+    s.length++;
+    int d = parent[(size_t) y * maze->w + x];
+    if (d == ROOT) break;
+    x += DIRECTIONS[d][0];
+    y += DIRECTIONS[d][1];
   }
+  return s;
+}
+
+// breadth first search. the queue is a flat array as long as the maze,
+// every cell goes in at most once
+Solution solve_bfs(Maze* maze) {
+  int w = maze->w;
+  size_t cells = (size_t) w * maze->h;
+  size_t goal = cells - 1;
+  uint8_t* parent = malloc(cells);
+  uint32_t* queue = malloc(cells * sizeof(uint32_t));
+  size_t head = 0, tail = 0;
+
+  memset(parent, NO_PARENT, cells);
+  parent[0] = ROOT;
+  queue[tail++] = 0;
+
+  while (head < tail) {
+    uint32_t idx = queue[head++];
+    if (idx == goal) break;
+    int x = idx % w, y = idx / w;
+
+    for (int d=0; d<4; ++d) {
+      if (!maze_open(maze, x, y, d)) continue;
+      uint32_t next = idx + DIRECTIONS[d][0] + DIRECTIONS[d][1] * w;
+      if (parent[next] != NO_PARENT) continue;
+      parent[next] = OPPOSITE[d];
+      queue[tail++] = next;
+    }
+  }
+
+  Solution s = solution_from_parents(maze, parent, head);
+  free(queue);
+  free(parent);
+  return s;
+}
+
+typedef struct {
+  uint32_t f, g, idx;
+} HeapEntry;
+
+// lower f first, and on a tie the deeper one, that is closer to the goal
+bool heap_less(HeapEntry a, HeapEntry b) {
+  return a.f < b.f || (a.f == b.f && a.g > b.g);
+}
+
+typedef struct {
+  HeapEntry* data;
+  size_t len, cap;
+} Heap;
+
+void heap_push(Heap* h, HeapEntry e) {
+  if (h->len == h->cap) {
+    h->cap = h->cap == 0 ? 1024 : h->cap * 2;
+    h->data = realloc(h->data, h->cap * sizeof(HeapEntry));
+  }
+
+  size_t i = h->len++;
+  while (i > 0 && heap_less(e, h->data[(i-1) / 2])) {
+    h->data[i] = h->data[(i-1) / 2];
+    i = (i-1) / 2;
+  }
+  h->data[i] = e;
+}
+
+HeapEntry heap_pop(Heap* h) {
+  HeapEntry top = h->data[0];
+  HeapEntry last = h->data[--h->len];
+
+  size_t i = 0;
+  while (true) {
+    size_t child = i * 2 + 1;
+    if (child >= h->len) break;
+    if (child + 1 < h->len && heap_less(h->data[child+1], h->data[child])) child++;
+    if (!heap_less(h->data[child], last)) break;
+    h->data[i] = h->data[child];
+    i = child;
+  }
+  h->data[i] = last;
+  return top;
+}
+
+// A* with the manhattan distance to the goal, on a binary heap.
+// a cell can be pushed again with a shorter distance: the old entries
+// are skipped when they come out
+Solution solve_astar(Maze* maze) {
+  int w = maze->w, h = maze->h;
+  size_t cells = (size_t) w * h;
+  uint8_t* parent = malloc(cells);
+  uint32_t* dist = malloc(cells * sizeof(uint32_t));
+  Heap heap = {0};
+  size_t expanded = 0;
+
+  memset(parent, NO_PARENT, cells);
+  memset(dist, 0xff, cells * sizeof(uint32_t));
+  parent[0] = ROOT;
+  dist[0] = 0;
+  heap_push(&heap, (HeapEntry) { w-1 + h-1, 0, 0 });
+
+  while (heap.len > 0) {
+    HeapEntry e = heap_pop(&heap);
+    if (e.g > dist[e.idx]) continue;
+    expanded++;
+    if (e.idx == cells - 1) break;
+    int x = e.idx % w, y = e.idx / w;
+
+    for (int d=0; d<4; ++d) {
+      if (!maze_open(maze, x, y, d)) continue;
+      int nx = x + DIRECTIONS[d][0];
+      int ny = y + DIRECTIONS[d][1];
+      uint32_t next = (uint32_t) ny * w + nx;
+      if (e.g + 1 >= dist[next]) continue;
+
+      dist[next] = e.g + 1;
+      parent[next] = OPPOSITE[d];
+      heap_push(&heap, (HeapEntry) { e.g + 1 + (w-1 - nx) + (h-1 - ny), e.g + 1, next });
+    }
+  }
+
+  Solution s = solution_from_parents(maze, parent, expanded);
+  free(heap.data);
+  free(dist);
+  free(parent);
+  return s;
+}
+
+// dead end filling: a dead end that isn't the start or the goal can't be on
+// the path, so it's filled, and its neighbour may become a dead end in turn.
+// in a perfect maze what's left unfilled is the path
+Solution solve_dead_ends(Maze* maze) {
+  int w = maze->w, h = maze->h;
+  size_t cells = (size_t) w * h;
+  uint8_t* degree = malloc(cells);
+  uint32_t* stack = malloc(cells * sizeof(uint32_t));
+  Bitmap filled = bitmap_new(w, h);
+  size_t len = 0, expanded = 0;
+
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      size_t idx = (size_t) y * w + x;
+      degree[idx] = 0;
+      for (int d=0; d<4; ++d) degree[idx] += maze_open(maze, x, y, d);
+      if (degree[idx] <= 1 && idx != 0 && idx != cells - 1) stack[len++] = idx;
+    }
+  }
+
+  while (len > 0) {
+    uint32_t idx = stack[--len];
+    int x = idx % w, y = idx / w;
+    if (bitmap_get(&filled, x, y)) continue;
+    bitmap_set(&filled, x, y);
+    expanded++;
+
+    for (int d=0; d<4; ++d) {
+      if (!maze_open(maze, x, y, d)) continue;
+      int nx = x + DIRECTIONS[d][0];
+      int ny = y + DIRECTIONS[d][1];
+      uint32_t next = (uint32_t) ny * w + nx;
+      if (bitmap_get(&filled, nx, ny)) continue;
+      if (--degree[next] == 1 && next != 0 && next != cells - 1) stack[len++] = next;
+    }
+  }
+
+  Solution s = { bitmap_new(w, h), 0, expanded };
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      if (bitmap_get(&filled, x, y)) continue;
+      bitmap_set(&s.path, x, y);
+      s.length++;
+    }
+  }
+
+  free(filled.bits);
+  free(stack);
+  free(degree);
+  return s;
+}
+
+typedef struct {
+  char* name;
+  Solution (*solve)(Maze* maze);
+} Solver;
+
+const Solver SOLVERS[] = {
+  { "bfs",       solve_bfs },
+  { "astar",     solve_astar },
+  { "dead-ends", solve_dead_ends },
+};
+#define SOLVERS_COUNT (int) (sizeof(SOLVERS) / sizeof(Solver))
+
+const Solver* solver_find(char* name) {
+  for (int i=0; i<SOLVERS_COUNT; ++i) {
+    if (strcmp(SOLVERS[i].name, name) == 0) return &SOLVERS[i];
+  }
+  return NULL;
+}
+
+// a perfect maze has a single path between any two cells: it's a spanning
+// tree of the grid, so it has w*h-1 passages and every cell is reachable
+bool maze_is_perfect(Maze* maze) {
+  int w = maze->w, h = maze->h;
+  size_t cells = (size_t) w * h;
+  size_t passages = 0;
+
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      int open = maze_get(maze, x, y);
+      if ((open & OPEN_RIGHT) && x == w-1) return false;
+      if ((open & OPEN_DOWN) && y == h-1) return false;
+      passages += (open & OPEN_RIGHT) + (open >> 1);
+    }
+  }
+  if (passages != cells - 1) return false;
+
+  // a breadth first search from the first cell, like solve_bfs
+  Bitmap seen = bitmap_new(w, h);
+  uint32_t* queue = malloc(cells * sizeof(uint32_t));
+  size_t head = 0, tail = 0;
+  bitmap_set(&seen, 0, 0);
+  queue[tail++] = 0;
+
+  while (head < tail) {
+    uint32_t idx = queue[head++];
+    int x = idx % w, y = idx / w;
+    for (int d=0; d<4; ++d) {
+      if (!maze_open(maze, x, y, d)) continue;
+      int nx = x + DIRECTIONS[d][0];
+      int ny = y + DIRECTIONS[d][1];
+      if (bitmap_get(&seen, nx, ny)) continue;
+      bitmap_set(&seen, nx, ny);
+      queue[tail++] = (uint32_t) ny * w + nx;
+    }
+  }
+
+  free(queue);
+  free(seen.bits);
+  return tail == cells;
+}
+
+// tiled generation: the maze is cut into square tiles, and worker threads
+// take them one at a time and run dfs_rect on them. tiles start on
+// multiples of 8 cells, so two tiles never write the same byte of
+// the maze or of a visited bitmap. every tile ends up as a perfect maze
+// of its own, then a random spanning tree over the tiles picks which
+// neighbouring tiles get a passage between them: one passage per edge
+// of a tree joins the trees of the tiles into one
+typedef struct {
+  Maze* maze;
+  int tile_size;
+  int tiles_x, tiles_y;
+  uint64_t seed;
+  atomic_int next;
+} TileJob;
+
+Rect tile_rect(TileJob* job, int t) {
+  Rect r = { .x = (t % job->tiles_x) * job->tile_size, .y = (t / job->tiles_x) * job->tile_size };
+  r.w = job->maze->w - r.x < job->tile_size ? job->maze->w - r.x : job->tile_size;
+  r.h = job->maze->h - r.y < job->tile_size ? job->maze->h - r.y : job->tile_size;
+  return r;
+}
+
+void* tile_worker(void* arg) {
+  TileJob* job = arg;
+  int tiles = job->tiles_x * job->tiles_y;
+
+  while (true) {
+    int t = atomic_fetch_add(&job->next, 1);
+    if (t >= tiles) break;
+
+    // every tile has its own stream, the result doesn't depend on the threads
+    Rng rng = rng_new(job->seed, t + 1);
+    Rect r = tile_rect(job, t);
+    dfs_rect(job->maze, r, r.x + rng_below(&rng, r.w), r.y + rng_below(&rng, r.h), &rng);
+  }
+
+  return NULL;
+}
+
+void gen_tiled(Maze* maze, int threads, int tile_size, uint64_t seed) {
+  TileJob job = { .maze = maze, .tile_size = (tile_size + 7) / 8 * 8 };
+  job.tiles_x = (maze->w + job.tile_size - 1) / job.tile_size;
+  job.tiles_y = (maze->h + job.tile_size - 1) / job.tile_size;
+  job.seed = seed;
+  atomic_init(&job.next, 0);
+
+  pthread_t* workers = malloc(threads * sizeof(pthread_t));
+  int started = 0;
+  while (started < threads && pthread_create(&workers[started], NULL, tile_worker, &job) == 0) {
+    started++;
+  }
+  // the tiles no thread took are done here, so the maze is whole even
+  // if no thread could start
+  if (started < threads) tile_worker(&job);
+  for (int i=0; i<started; ++i) pthread_join(workers[i], NULL);
+  free(workers);
+
+  // kruskal over the tiles, like gen_kruskal over the cells
+  Rng rng = rng_new(seed, 0);
+  uint32_t tiles = job.tiles_x * job.tiles_y;
+  uint32_t* parent = malloc(tiles * sizeof(uint32_t));
+  uint32_t* edges = malloc(tiles * 2 * sizeof(uint32_t));
+  size_t count = 0;
+  for (uint32_t t=0; t<tiles; ++t) {
+    parent[t] = t;
+    if (t % job.tiles_x != (uint32_t) job.tiles_x-1) edges[count++] = t * 2;
+    if (t / job.tiles_x != (uint32_t) job.tiles_y-1) edges[count++] = t * 2 + 1;
+  }
+  for (size_t i=count; i>1; --i) {
+    size_t j = rng_below(&rng, i);
+    uint32_t tmp = edges[i-1];
+    edges[i-1] = edges[j];
+    edges[j] = tmp;
+  }
+
+  for (size_t i=0; i<count; ++i) {
+    uint32_t t = edges[i] / 2;
+    bool down = edges[i] % 2;
+    uint32_t a = uf_find(parent, t);
+    uint32_t b = uf_find(parent, down ? t + job.tiles_x : t + 1);
+    if (a == b) continue;
+    parent[a] = b;
+
+    // a random cell on the side of the tile facing the other one
+    Rect r = tile_rect(&job, t);
+    if (down) {
+      maze_set(maze, r.x + rng_below(&rng, r.w), r.y + r.h - 1, OPEN_DOWN);
+    } else {
+      maze_set(maze, r.x + r.w - 1, r.y + rng_below(&rng, r.h), OPEN_RIGHT);
+    }
+  }
+
+  free(edges);
+  free(parent);
 }
 
 /*
@@ -100,162 +1065,820 @@ lrdu
 1111 => cross
 */
 
-char cell_to_char(CellNode* cell) {
-  int code = (cell->left << 3) 
-    | (cell->right << 2)
-    | (cell->down << 1) 
-    | (cell->up << 0);
-      
-  char c;
-  switch (code) {
-    case 1:
-    case 2:
-    case 3: c = Vert; break;
-    
-    case 4:
-    case 8:
-    case 12: c = Hori; break;
-
-    case 5: c = RightUp; break;
-    case 6: c = RightDown; break;
-    case 7: c = VertRight; break;
-
-    case 9:  c = LeftUp; break;
-    case 10: c = LeftDown; break;
-    case 11: c = VertLeft; break;
-
-    case 13: c = HoriUp; break;
-    case 14: c = HoriDown; break;
-    case 15: c = Cross; break;
-    default: c = Empty; break;
-  }
-  return c;
-}
-
-void print(CellNode maze[][32], int w, int h) {
-  for(int i=0; i<h; ++i) {
-    for(int j=0; j<w; ++j) {
-      CellNode* curr = &maze[i][j];
-      int code = (curr->left << 3) 
-        | (curr->right << 2)
-        | (curr->down << 1) 
-        | (curr->up << 0);
-      
-      char c;
-      switch (code) {
-        case 1:
-        case 2:
-        case 3: c = Vert; break;
-        
-        case 4:
-        case 8:
-        case 12: c = Hori; break;
-
-        case 5: c = RightUp; break;
-        case 6: c = RightDown; break;
-        case 7: c = VertRight; break;
-
-        case 9:  c = LeftUp; break;
-        case 10: c = LeftDown; break;
-        case 11: c = VertLeft; break;
-
-        case 13: c = HoriUp; break;
-        case 14: c = HoriDown; break;
-        case 15: c = Cross; break;
-        default: c = Empty; break;
-      }
+// the lrdu code of every cell of a row, from the packed bits
+// of the row and of the one above it, NULL for the first row
+void row_codes(uint8_t* codes, uint8_t* above, uint8_t* row, int w) {
+  int left = 0;
+  for (int x=0; x<w; ++x) {
+    int open = row_get(row, x);
+    int up = above != NULL && (row_get(above, x) & OPEN_DOWN);
+    codes[x] = (left << 3) | ((open & OPEN_RIGHT) << 2) | (open & OPEN_DOWN) | up;
+    left = open & OPEN_RIGHT;
+  }
+}
 
-      putchar(c);
-    }
+// text renderers turn every cell into a glyph, picked from a table of 16.
+// graph styles index it with the lrdu code and draw the passages.
+// walls styles draw the wall on the left of a cell and the one below it,
+// the r bit is ignored and u is replaced by the left passage of the cell
+// below, which decides if the bottom wall reaches the corner.
+// cells on the path of a solution take their glyph from the second table
+typedef struct {
+  char* name;
+  const char* glyphs[16];
+  const char* path[16];
+  bool walls;
+} TextStyle;
+  
+const TextStyle TEXT_STYLES[] = {
+  { "utf8", {
+    " ", "║", "║", "║", "═", "╚", "╔", "╠",
+    "═", "╝", "╗", "╣", "═", "╩", "╦", "╬",
+  }, {
+    "●", "┃", "┃", "┃", "━", "┗", "┏", "┣",
+    "━", "┛", "┓", "┫", "━", "┻", "┳", "╋",
+  }, false },
+  // double line box drawing of code page 437, as the first version printed.
+  // the path is drawn with the single line ones
+  { "cp437", {
+    "\xff", "\xba", "\xba", "\xba", "\xcd", "\xc8", "\xc9", "\xcc",
+    "\xcd", "\xbc", "\xbb", "\xb9", "\xcd", "\xca", "\xcb", "\xce",
+  }, {
+    "\xfe", "\xb3", "\xb3", "\xb3", "\xc4", "\xc0", "\xda", "\xc3",
+    "\xc4", "\xd9", "\xbf", "\xb4", "\xc4", "\xc1", "\xc2", "\xc5",
+  }, false },
+  // no room for the path here when there's a wall below the cell
+  { "ascii", {
+    "|_", "|_", "| ", "| ", "|_", "|_", "| ", "| ",
+    " _", "__", "  ", "  ", " _", "__", "  ", "  ",
+  }, {
+    "|_", "|_", "|*", "|*", "|_", "|_", "|*", "|*",
+    " _", "__", " *", " *", " _", "__", " *", " *",
+  }, true },
+  { "ascii-wide", {
+    "|_ ", "|_ ", "|  ", "|  ", "|_ ", "|_ ", "|  ", "|  ",
+    " _ ", "__ ", "   ", "   ", " _ ", "__ ", "   ", "   ",
+  }, {
+    "|_*", "|_*", "| *", "| *", "|_*", "|_*", "| *", "| *",
+    " _*", "__*", "  *", "  *", " _*", "__*", "  *", "  *",
+  }, true },
+};
+#define TEXT_STYLES_COUNT (int) (sizeof(TEXT_STYLES) / sizeof(TextStyle))
 
-    putchar('\n');
+const TextStyle* text_style_find(char* name) {
+  for (int i=0; i<TEXT_STYLES_COUNT; ++i) {
+    if (strcmp(TEXT_STYLES[i].name, name) == 0) return &TEXT_STYLES[i];
   }
+  return NULL;
+}
+
+// glyphs are copied 4 bytes at a time, whatever their length,
+// so there's room for 4 bytes every cell plus the border and the newline
+size_t text_row_size(int w) {
+  return (size_t) w * 4 + 2;
 }
 
-void better_print(CellNode maze[][32], int w, int h) {
-  char framebuf[h][w * 2];
+// renders a row into out, from the codes of the row and of the one below,
+// NULL for the last row. path is the row of the solution bitmap, if any.
+// returns the length written, newline included
+size_t text_row(char* out, const TextStyle* style, uint8_t* codes, uint8_t* below, uint8_t* path, int w) {
+  char glyphs[32][4] = {0};
+  int lens[32];
+  for (int i=0; i<32; ++i) {
+    const char* glyph = i < 16 ? style->glyphs[i] : style->path[i-16];
+    lens[i] = strlen(glyph);
+    memcpy(glyphs[i], glyph, lens[i]);
+  }
+
+  char* c = out;
+  for (int x=0; x<w; ++x) {
+    int code = codes[x];
+    if (style->walls) {
+      bool corner = below == NULL || (below[x] & 8);
+      code = (code & ~1) | corner;
+    }
+    if (path != NULL && (path[x/8] & (1 << x%8))) code += 16;
+    memcpy(c, glyphs[code], 4);
+    c += lens[code];
+  }
+
+  if (style->walls) *c++ = '|';
+  *c++ = '\n';
+  return c - out;
+}
+
+// the top border of walls styles
+size_t text_top(char* out, const TextStyle* style, int w) {
+  if (!style->walls) return 0;
+  size_t len = (size_t) w * strlen(style->glyphs[0]);
+  out[0] = ' ';
+  memset(out + 1, '_', len - 1);
+  out[len++] = '\n';
+  return len;
+}
   
-  for(int i=0; i<h; ++i) {
-    for(int j=0; j<w; ++j) {
-      CellNode* curr = &maze[i][j];
-      if (!curr->down) {
-        if (i != h-1) {
-          CellNode* below = &maze[i+1][j];
-          if (below->left) framebuf[i][j*2+0] = '_';
-        } else {
-          framebuf[i][j*2+0] = '_';
-        }
-
-        framebuf[i][j*2+1] = '_';
-      }
-      if (!curr->left) framebuf[i][j*2] = '|';
+// keeps the codes of two rows, as every row needs the one below it.
+// each row goes out with a single fwrite
+void render_text(Maze* maze, const TextStyle* style, Bitmap* path, FILE* out) {
+  int w = maze->w;
+  char* buf = malloc(text_row_size(w));
+  uint8_t* codes = malloc(w);
+  uint8_t* below = malloc(w);
+
+  fwrite(buf, 1, text_top(buf, style, w), out);
+  row_codes(codes, NULL, maze->bits, w);
+  for (int y=0; y<maze->h; ++y) {
+    uint8_t* row = &maze->bits[y * maze->stride];
+    bool last = y == maze->h-1;
+    if (!last) row_codes(below, row, row + maze->stride, w);
+    uint8_t* path_row = path != NULL ? &path->bits[y * path->stride] : NULL;
+    fwrite(buf, 1, text_row(buf, style, codes, last ? NULL : below, path_row, w), out);
+
+    uint8_t* tmp = codes;
+    codes = below;
+    below = tmp;
+  }
+
+  free(below);
+  free(codes);
+  free(buf);
+}
+
+// image renderers draw every cell as 2x2 pixels, plus a border on the top
+// and on the left: the cell, the passage to its right, the passage below
+// and the corner. a cell row gives two pixel rows, a byte of the packed
+// maze gives a byte of each, so a table of 256 entries does all the work
+typedef struct {
+  uint8_t cells, walls;
+} PixelPair;
+
+PixelPair PIXELS[256];
+
+// pixels are 1 for black, the most significant bit first
+void pixels_init() {
+  for (int b=0; b<256; ++b) {
+    uint8_t cells = 0, walls = 0;
+    for (int k=0; k<4; ++k) {
+      int open = (b >> (k * 2)) & 3;
+      if (!(open & OPEN_RIGHT)) cells |= 1 << (6 - k * 2);
+      if (!(open & OPEN_DOWN)) walls |= 1 << (7 - k * 2);
+      walls |= 1 << (6 - k * 2);
     }
+    PIXELS[b] = (PixelPair) { cells, walls };
   }
+}
 
-  putchar(' ');
-  for(int j=1; j<w*2; ++j) {
-    putchar('_');
+size_t image_width(Maze* maze) {
+  return (size_t) maze->w * 2 + 1;
+}
+
+size_t image_stride(Maze* maze) {
+  return (image_width(maze) + 7) / 8;
+}
+
+// the two pixel rows of a row of cells. the table output is shifted
+// right by one pixel to make room for the left border
+void image_rows(uint8_t* cells, uint8_t* walls, Maze* maze, uint8_t* row) {
+  uint8_t prev_cells = 0xff, prev_walls = 0xff;
+  for (size_t i=0; i<image_stride(maze); ++i) {
+    PixelPair p = i < maze->stride ? PIXELS[row[i]] : (PixelPair) { 0xff, 0xff };
+    cells[i] = (prev_cells << 7) | (p.cells >> 1);
+    walls[i] = (prev_walls << 7) | (p.walls >> 1);
+    prev_cells = p.cells;
+    prev_walls = p.walls;
   }
-  putchar('\n');
+}
+
+// binary portable bitmap
+void render_pbm(Maze* maze, FILE* out) {
+  size_t stride = image_stride(maze);
+  uint8_t* cells = malloc(stride);
+  uint8_t* walls = malloc(stride);
+
+  fprintf(out, "P4\n%zu %zu\n", image_width(maze), (size_t) maze->h * 2 + 1);
+  memset(walls, 0xff, stride);
+  fwrite(walls, 1, stride, out);
+  for (int y=0; y<maze->h; ++y) {
+    image_rows(cells, walls, maze, &maze->bits[y * maze->stride]);
+    fwrite(cells, 1, stride, out);
+    fwrite(walls, 1, stride, out);
+  }
+
+  free(walls);
+  free(cells);
+}
+
+uint32_t CRC_TABLE[256];
+
+void crc_init() {
+  for (uint32_t n=0; n<256; ++n) {
+    uint32_t c = n;
+    for (int k=0; k<8; ++k) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    CRC_TABLE[n] = c;
+  }
+}
+
+uint32_t crc_update(uint32_t crc, uint8_t* data, size_t len) {
+  for (size_t i=0; i<len; ++i) crc = CRC_TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+void put_u32(uint8_t* out, uint32_t val) {
+  out[0] = val >> 24;
+  out[1] = val >> 16;
+  out[2] = val >> 8;
+  out[3] = val;
+}
+
+void png_chunk(FILE* out, char* type, uint8_t* data, size_t len) {
+  uint8_t head[8];
+  put_u32(head, len);
+  memcpy(head + 4, type, 4);
+  uint32_t crc = crc_update(0xffffffff, head + 4, 4);
+  if (len > 0) crc = crc_update(crc, data, len);
+
+  uint8_t tail[4];
+  put_u32(tail, crc ^ 0xffffffff);
+  fwrite(head, 1, 8, out);
+  if (len > 0) fwrite(data, 1, len, out);
+  fwrite(tail, 1, 4, out);
+}
+
+// PNG writer for the pixel rows. every row becomes an IDAT chunk holding
+// deflate stored blocks, so nothing is compressed: the image is one bit
+// per pixel like the PBM, without depending on zlib
+typedef struct {
+  FILE* out;
+  // filter byte and pixels of a row, then the chunk it goes in
+  uint8_t* row;
+  uint8_t* chunk;
+  uint32_t adler_a, adler_b;
+  bool first;
+} PngWriter;
+
+#define DEFLATE_BLOCK 65535
+
+PngWriter png_begin(FILE* out, size_t width, size_t height) {
+  uint8_t header[13];
+  put_u32(header, width);
+  put_u32(header + 4, height);
+  // bit depth 1, grayscale, deflate, no filters, not interlaced
+  memcpy(header + 8, (uint8_t[]) { 1, 0, 0, 0, 0 }, 5);
+
+  fwrite("\x89PNG\r\n\x1a\n", 1, 8, out);
+  png_chunk(out, "IHDR", header, sizeof(header));
+
+  size_t len = (width + 7) / 8 + 1;
+  PngWriter png = { out, malloc(len), NULL, 1, 0, true };
+  // zlib header and a 5 bytes header every block
+  png.chunk = malloc(2 + len + (len / DEFLATE_BLOCK + 1) * 5);
+  return png;
+}
 
-  for(int i=0; i<h; ++i) {
-    for(int j=0; j<w*2; ++j) {
-      char c = framebuf[i][j];
-      if (c == 0) c = ' ';
-      putchar(c);
+// a pixel row, 1 for black like the PBM: PNG grayscale has 1 for white
+void png_row(PngWriter* png, uint8_t* pixels, size_t stride, bool last) {
+  uint8_t* row = png->row;
+  size_t len = stride + 1;
+  row[0] = 0;
+  for (size_t i=0; i<stride; ++i) row[i+1] = ~pixels[i];
+
+  // the sums fit 32 bits for 5552 bytes before they have to be reduced
+  for (size_t i=0; i<len; ) {
+    size_t end = len - i < 5552 ? len : i + 5552;
+    for (; i<end; ++i) {
+      png->adler_a += row[i];
+      png->adler_b += png->adler_a;
     }
+    png->adler_a %= 65521;
+    png->adler_b %= 65521;
+  }
+
+  uint8_t* c = png->chunk;
+  if (png->first) {
+    *c++ = 0x78;
+    *c++ = 0x01;
+    png->first = false;
+  }
 
-    putchar('|');
-    putchar('\n');
+  // a stored block can't be longer than 64k, long rows take more than one
+  for (size_t done=0; done<len; ) {
+    size_t block = len - done < DEFLATE_BLOCK ? len - done : DEFLATE_BLOCK;
+    *c++ = last && done + block == len;
+    *c++ = block;
+    *c++ = block >> 8;
+    *c++ = ~block;
+    *c++ = ~block >> 8;
+    memcpy(c, row + done, block);
+    c += block;
+    done += block;
   }
+
+  png_chunk(png->out, "IDAT", png->chunk, c - png->chunk);
 }
 
-void better_print_large(CellNode maze[][32], int w, int h) {
-  char framebuf[h][w * 3];
-  
-  for(int i=0; i<h; ++i) {
-    for(int j=0; j<w; ++j) {
-      CellNode* curr = &maze[i][j];
-      if (!curr->down) {
-        if (i != h-1) {
-          CellNode* below = &maze[i+1][j];
-          if (below->left) framebuf[i][j*3+0] = '_';
-        } else {
-          framebuf[i][j*3+0] = '_';
-        }
-
-        framebuf[i][j*3+1] = '_';
+void png_end(PngWriter* png) {
+  uint8_t adler[4];
+  put_u32(adler, (png->adler_b << 16) | png->adler_a);
+  png_chunk(png->out, "IDAT", adler, 4);
+  png_chunk(png->out, "IEND", NULL, 0);
+  free(png->chunk);
+  free(png->row);
+}
+
+void render_png(Maze* maze, FILE* out) {
+  size_t stride = image_stride(maze);
+  uint8_t* cells = malloc(stride);
+  uint8_t* walls = malloc(stride);
+
+  PngWriter png = png_begin(out, image_width(maze), (size_t) maze->h * 2 + 1);
+  memset(walls, 0xff, stride);
+  png_row(&png, walls, stride, false);
+  for (int y=0; y<maze->h; ++y) {
+    image_rows(cells, walls, maze, &maze->bits[y * maze->stride]);
+    png_row(&png, cells, stride, false);
+    png_row(&png, walls, stride, y == maze->h-1);
+  }
+  png_end(&png);
+
+  free(walls);
+  free(cells);
+}
+
+// text styles by name, then the images. only text draws the path
+bool render(Maze* maze, char* name, Bitmap* path, FILE* out) {
+  const TextStyle* style = text_style_find(name);
+  if (style != NULL) {
+    render_text(maze, style, path, out);
+  } else if (strcmp(name, "pbm") == 0) {
+    render_pbm(maze, out);
+  } else if (strcmp(name, "png") == 0) {
+    render_png(maze, out);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+double time_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+long peak_rss_kb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// generates square mazes of growing size, up to max_size per side
+int bench(int max_size) {
+  Rng rng = rng_new(1, 0);
+
+  for (int size=250; size<=max_size; size*=2) {
+    double start = time_now_ns();
+    Maze maze = maze_new(size, size);
+    dfs(&maze, 0, 0, &rng);
+    double elapsed = time_now_ns() - start;
+
+    double cells = (double) size * size;
+    printf("%6dx%-6d %8.1f ms  %6.1f Mcells/s  grid %7.1f MB  peak rss %7.1f MB\n",
+      size, size, elapsed / 1e6, cells / elapsed * 1e3,
+      maze_bytes(&maze) / 1e6, peak_rss_kb() / 1e3);
+    maze_free(&maze);
+
+    // the last step is max_size itself
+    if (size < max_size && size * 2 > max_size) size = max_size / 2;
+  }
+
+  return 0;
+}
+
+// every generator runs in its own child process,
+// so the peak rss is its own and not the one of the generator before
+int bench_generators(int max_size) {
+  for (int i=0; i<GENERATORS_COUNT; ++i) {
+    for (int size=250; size<=max_size; size*=2) {
+      fflush(stdout);
+      pid_t pid = fork();
+      if (pid == 0) {
+        Rng rng = rng_new(1, 0);
+        double start = time_now_ns();
+        Maze maze = maze_new(size, size);
+        GENERATORS[i].generate(&maze, &rng);
+        double elapsed = time_now_ns() - start;
+
+        printf("%-12s %6dx%-6d %8.1f ms  %6.1f Mcells/s  peak rss %7.1f MB\n",
+          GENERATORS[i].name, size, size, elapsed / 1e6,
+          (double) size * size / elapsed * 1e3, peak_rss_kb() / 1e3);
+        maze_free(&maze);
+        exit(0);
       }
-      if (!curr->left) framebuf[i][j*3] = '|';
+      if (pid > 0) waitpid(pid, NULL, 0);
+
+      if (size < max_size && size * 2 > max_size) size = max_size / 2;
+    }
+  }
+
+  return 0;
+}
+
+// generates a maze with Eller's algorithm and prints it as it goes.
+// only two rows are kept: a row is printed as soon as the one below it
+// is known, so the height isn't bounded by memory
+// without a style, it writes a maze file instead of text.
+// the rows come out the same as gen_eller with the same seed
+int stream(int w, long h, const TextStyle* style, uint64_t seed, FILE* out) {
+  Rng rng = rng_new(seed, 0);
+  Eller e = eller_new(w);
+  size_t stride = ((size_t) w + 3) / 4;
+  uint8_t* row = malloc(stride);
+  uint8_t* below = malloc(stride);
+  uint8_t* codes = malloc(w);
+  uint8_t* below_codes = malloc(w);
+  char* buf = malloc(text_row_size(w));
+  size_t bytes = 0;
+  double start = time_now_ns();
+
+  if (style != NULL) {
+    bytes += fwrite(buf, 1, text_top(buf, style, w), out);
+  } else {
+    MazeHeader header = maze_header(w, h, seed);
+    bytes += fwrite(&header, 1, sizeof(header), out);
+  }
+  eller_row(&e, row, h == 1, &rng);
+  row_codes(codes, NULL, row, w);
+  for (long y=0; y<h; ++y) {
+    bool last = y == h-1;
+    if (!last) {
+      eller_row(&e, below, y+1 == h-1, &rng);
+      if (style != NULL) row_codes(below_codes, row, below, w);
+    }
+    if (style != NULL) {
+      bytes += fwrite(buf, 1, text_row(buf, style, codes, last ? NULL : below_codes, NULL, w), out);
+    } else {
+      bytes += fwrite(row, 1, stride, out);
     }
+
+    uint8_t* tmp = row;
+    row = below;
+    below = tmp;
+    tmp = codes;
+    codes = below_codes;
+    below_codes = tmp;
   }
+  fflush(out);
+
+  double elapsed = time_now_ns() - start;
+  fprintf(stderr, "%dx%ld: %.1f MB in %.1f ms (%.0f MB/s), peak rss %.1f MB\n",
+    w, h, bytes / 1e6, elapsed / 1e6, bytes / elapsed * 1e3, peak_rss_kb() / 1e3);
+
+  free(buf);
+  free(below_codes);
+  free(codes);
+  free(below);
+  free(row);
+  eller_free(&e);
+  return 0;
+}
+
+char* RENDERERS[] = { "utf8", "cp437", "ascii", "ascii-wide", "pbm", "png" };
+#define RENDERERS_COUNT (int) (sizeof(RENDERERS) / sizeof(char*))
+
+// renders the same maze with every back-end, into a temporary file
+int bench_render(int size) {
+  FILE* tmp = tmpfile();
+  Rng rng = rng_new(1, 0);
+  Maze maze = maze_new(size, size);
+  gen_binary_tree(&maze, &rng);
 
-  putchar(' ');
-  for(int j=1; j<w*3; ++j) {
-    putchar('_');
+  for (int i=0; i<RENDERERS_COUNT; ++i) {
+    double start = time_now_ns();
+    render(&maze, RENDERERS[i], NULL, tmp);
+    fflush(tmp);
+    double elapsed = time_now_ns() - start;
+    long bytes = ftell(tmp);
+    rewind(tmp);
+
+    printf("%-11s %dx%d  %8.1f ms  %7.1f MB  %5.2f ns/cell\n", RENDERERS[i], size, size,
+      elapsed / 1e6, bytes / 1e6, elapsed / ((double) size * size));
   }
-  putchar('\n');
 
-  for(int i=0; i<h; ++i) {
-    for(int j=0; j<w*3; ++j) {
-      char c = framebuf[i][j];
-      if (c == 0) c = ' ';
-      putchar(c);
+  maze_free(&maze);
+  fclose(tmp);
+  return 0;
+}
+
+// solves mazes with very different textures: dfs makes long corridors,
+// prim many short dead ends and binary tree a diagonal bias
+int bench_solvers(int size) {
+  char* generators[] = { "dfs", "prim", "binary-tree" };
+
+  for (size_t i=0; i<sizeof(generators)/sizeof(char*); ++i) {
+    Rng rng = rng_new(1, 0);
+    Maze maze = maze_new(size, size);
+    generator_find(generators[i])->generate(&maze, &rng);
+
+    for (int j=0; j<SOLVERS_COUNT; ++j) {
+      double start = time_now_ns();
+      Solution s = SOLVERS[j].solve(&maze);
+      double elapsed = time_now_ns() - start;
+
+      printf("%-12s %dx%d  %-10s %8.1f ms  %9zu expanded  path %zu\n", generators[i], size, size,
+        SOLVERS[j].name, elapsed / 1e6, s.expanded, s.length);
+      solution_free(&s);
     }
+    maze_free(&maze);
+  }
 
-    putchar('|');
-    putchar('\n');
+  return 0;
+}
+
+// the single threaded dfs against tiled generation with more and more threads.
+// tiles are generated independently, so each thread count gives the same
+// maze and only the time should change; every maze goes through the checker
+int bench_parallel(int size, int tile_size) {
+  Rng rng = rng_new(1, 0);
+  double start = time_now_ns();
+  Maze maze = maze_new(size, size);
+  dfs(&maze, 0, 0, &rng);
+  double base = time_now_ns() - start;
+  printf("dfs        %dx%d  %8.1f ms  %6.1f Mcells/s  perfect %s\n", size, size,
+    base / 1e6, (double) size * size / base * 1e3, maze_is_perfect(&maze) ? "yes" : "NO");
+  maze_free(&maze);
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_threads = cores > 4 ? cores : 4;
+  for (int threads=1; threads<=max_threads; threads*=2) {
+    start = time_now_ns();
+    maze = maze_new(size, size);
+    gen_tiled(&maze, threads, tile_size, 1);
+    double elapsed = time_now_ns() - start;
+    printf("tiled x%-3d %dx%d  %8.1f ms  %6.1f Mcells/s  speedup %4.2fx  perfect %s\n",
+      threads, size, size, elapsed / 1e6, (double) size * size / elapsed * 1e3,
+      base / elapsed, maze_is_perfect(&maze) ? "yes" : "NO");
+    maze_free(&maze);
   }
+  printf("(%ld cores online)\n", cores);
+
+  return 0;
 }
 
-int main() {
-  srand(time(NULL));
+// the cost of the random numbers alone, then of every generator with the
+// words it draws per cell. libc rand() gives 31 bits per call, and
+// the generators used to take one call for every choice
+int bench_rng(int size) {
+  long n = 100000000;
+  double start = time_now_ns();
+  unsigned sum = 0;
+  srand(1);
+  for (long i=0; i<n; ++i) sum += rand() % 4;
+  double elapsed = time_now_ns() - start;
+  printf("rand() %% 4      %6.2f ns/call\n", elapsed / n);
+
+  Rng rng = rng_new(1, 0);
+  start = time_now_ns();
+  for (long i=0; i<n; ++i) sum += rng_next(&rng) % 4;
+  elapsed = time_now_ns() - start;
+  printf("rng_next %% 4    %6.2f ns/call\n", elapsed / n);
+
+  start = time_now_ns();
+  for (long i=0; i<n; ++i) sum += rng_below(&rng, 4);
+  elapsed = time_now_ns() - start;
+  printf("rng_below(4)    %6.2f ns/call  (%u)\n", elapsed / n, sum % 2);
 
-  CellNode maze[20][32] = {0};
-  dfs(maze, 32, 20, 0, 0);
-  print(maze, 32, 20);
-  better_print(maze, 32, 20);
-  better_print_large(maze, 32, 20);
+  double cells = (double) size * size;
+  for (int i=0; i<GENERATORS_COUNT; ++i) {
+    rng = rng_new(1, 0);
+    start = time_now_ns();
+    Maze maze = maze_new(size, size);
+    GENERATORS[i].generate(&maze, &rng);
+    elapsed = time_now_ns() - start;
+    printf("%-12s %dx%d  %8.1f ms  %6.1f Mcells/s  %5.3f words/cell\n", GENERATORS[i].name,
+      size, size, elapsed / 1e6, cells / elapsed * 1e3, rng.words / cells);
+    maze_free(&maze);
+  }
 
   return 0;
-}
\ No newline at end of file
+}
+
+// saves a maze and maps it back. mapping only reads the edges of the
+// maze, to check them: the other pages are read when the cells in them are
+int bench_file(int size) {
+  Rng rng = rng_new(1, 0);
+  Maze maze = maze_new(size, size);
+  gen_binary_tree(&maze, &rng);
+  FILE* tmp = tmpfile();
+
+  double start = time_now_ns();
+  maze_save(&maze, 1, tmp);
+  double elapsed = time_now_ns() - start;
+  printf("save     %dx%d  %8.3f ms  %7.1f MB  %6.0f MB/s\n", size, size,
+    elapsed / 1e6, maze_bytes(&maze) / 1e6, maze_bytes(&maze) / elapsed * 1e3);
+
+  Maze loaded;
+  uint64_t seed;
+  start = time_now_ns();
+  if (!maze_map(fileno(tmp), "tmpfile", &loaded, &seed)) return 1;
+  elapsed = time_now_ns() - start;
+  printf("map      %dx%d  %8.3f ms\n", size, size, elapsed / 1e6);
+
+  start = time_now_ns();
+  int corner = maze_get(&loaded, size-1, size-1);
+  elapsed = time_now_ns() - start;
+  printf("1 cell   %dx%d  %8.3f ms\n", size, size, elapsed / 1e6);
+
+  start = time_now_ns();
+  bool same = memcmp(maze.bits, loaded.bits, maze_bytes(&maze)) == 0;
+  elapsed = time_now_ns() - start;
+  printf("compare  %dx%d  %8.3f ms  same %s\n", size, size, elapsed / 1e6,
+    same && corner == maze_get(&maze, size-1, size-1) ? "yes" : "NO");
+
+  // a streamed file has to be the one --algo eller --save writes
+  // with the same seed
+  int eller_size = size < 2000 ? size : 2000;
+  Maze eller = maze_new(eller_size, eller_size);
+  rng = rng_new(7, 0);
+  gen_eller(&eller, &rng);
+  FILE* saved = tmpfile();
+  FILE* streamed = tmpfile();
+  maze_save(&eller, 7, saved);
+  stream(eller_size, eller_size, NULL, 7, streamed);
+  rewind(saved);
+  rewind(streamed);
+  int a, b;
+  do {
+    a = getc(saved);
+    b = getc(streamed);
+  } while (a == b && a != EOF);
+  printf("stream   %dx%d  same as saved eller %s\n", eller_size, eller_size, a == b ? "yes" : "NO");
+
+  fclose(streamed);
+  fclose(saved);
+  maze_free(&eller);
+  maze_free(&loaded);
+  maze_free(&maze);
+  fclose(tmp);
+  return !same || a != b;
+}
+
+int usage(char* name) {
+  fprintf(stderr, "usage: %s [--algo name] [--render name] [--solve name] [width] [height]\n", name);
+  fprintf(stderr, "       %s [--seed n] [--threads n] [--tile size] [--check] [--save file] ...\n", name);
+  fprintf(stderr, "       %s --load file [--render name] [--solve name] [--check]\n", name);
+  fprintf(stderr, "       %s --stream width height [text renderer | file] [--seed n]\n", name);
+  fprintf(stderr, "       %s --bench [max size] | --bench-gen [max size] | --bench-render [size]\n", name);
+  fprintf(stderr, "       %s --bench-solve [size] | --bench-parallel [size] [tile size]\n", name);
+  fprintf(stderr, "       %s --bench-rng [size] | --bench-file [size]\n", name);
+  fprintf(stderr, "algorithms:");
+  for (int i=0; i<GENERATORS_COUNT; ++i) fprintf(stderr, " %s", GENERATORS[i].name);
+  fprintf(stderr, "\nrenderers:");
+  for (int i=0; i<RENDERERS_COUNT; ++i) fprintf(stderr, " %s", RENDERERS[i]);
+  fprintf(stderr, "\nsolvers:");
+  for (int i=0; i<SOLVERS_COUNT; ++i) fprintf(stderr, " %s", SOLVERS[i].name);
+  fprintf(stderr, "\n");
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  pixels_init();
+  crc_init();
+
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    return bench(argc > 2 ? atoi(argv[2]) : 10000);
+  }
+  if (argc > 1 && strcmp(argv[1], "--bench-gen") == 0) {
+    return bench_generators(argc > 2 ? atoi(argv[2]) : 2000);
+  }
+  if (argc > 1 && strcmp(argv[1], "--bench-solve") == 0) {
+    return bench_solvers(argc > 2 ? atoi(argv[2]) : 2000);
+  }
+  if (argc > 1 && strcmp(argv[1], "--bench-render") == 0) {
+    return bench_render(argc > 2 ? atoi(argv[2]) : 4000);
+  }
+  if (argc > 1 && strcmp(argv[1], "--bench-parallel") == 0) {
+    return bench_parallel(argc > 2 ? atoi(argv[2]) : 4000, argc > 3 ? atoi(argv[3]) : 256);
+  }
+  if (argc > 1 && strcmp(argv[1], "--bench-rng") == 0) {
+    return bench_rng(argc > 2 ? atoi(argv[2]) : 2000);
+  }
+  if (argc > 1 && strcmp(argv[1], "--bench-file") == 0) {
+    return bench_file(argc > 2 ? atoi(argv[2]) : 16000);
+  }
+  if (argc > 3 && strcmp(argv[1], "--stream") == 0) {
+    int w = atoi(argv[2]);
+    long h = atol(argv[3]);
+    char* name = "ascii";
+    uint64_t seed = time(NULL);
+    for (int i=4; i<argc; ++i) {
+      if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+        seed = strtoull(argv[++i], NULL, 10);
+      } else if (i == 4) {
+        name = argv[i];
+      } else {
+        return usage(argv[0]);
+      }
+    }
+    bool file = strcmp(name, "file") == 0;
+    const TextStyle* style = text_style_find(name);
+    if (w <= 0 || h <= 0 || (style == NULL && !file)) return usage(argv[0]);
+    if (file && h > INT32_MAX) return usage(argv[0]);
+    return stream(w, h, style, seed, stdout);
+  }
+
+  const Generator* gen = &GENERATORS[0];
+  char* renderer = NULL;
+  const Solver* solver = NULL;
+  int w = 32, h = 20;
+  int threads = 0, tile_size = 256;
+  bool check = false;
+  char* save = NULL;
+  char* load = NULL;
+  uint64_t seed = time(NULL);
+  int positional = 0;
+  for (int i=1; i<argc; ++i) {
+    if (strcmp(argv[i], "--algo") == 0 && i+1 < argc) {
+      gen = generator_find(argv[++i]);
+      if (gen == NULL) return usage(argv[0]);
+    } else if (strcmp(argv[i], "--render") == 0 && i+1 < argc) {
+      renderer = argv[++i];
+    } else if (strcmp(argv[i], "--solve") == 0 && i+1 < argc) {
+      solver = solver_find(argv[++i]);
+      if (solver == NULL) return usage(argv[0]);
+    } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+      threads = atoi(argv[++i]);
+      if (threads <= 0) return usage(argv[0]);
+    } else if (strcmp(argv[i], "--tile") == 0 && i+1 < argc) {
+      tile_size = atoi(argv[++i]);
+      if (tile_size <= 0) return usage(argv[0]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--save") == 0 && i+1 < argc) {
+      save = argv[++i];
+    } else if (strcmp(argv[i], "--load") == 0 && i+1 < argc) {
+      load = argv[++i];
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check = true;
+    } else if (positional == 0) {
+      w = atoi(argv[i]);
+      positional++;
+    } else if (positional == 1) {
+      h = atoi(argv[i]);
+      positional++;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+
+  Maze maze;
+  if (load != NULL) {
+    if (!maze_load(load, &maze, &seed)) return 1;
+    // solvers and the checker number the cells with 32 bits
+    if ((solver != NULL || check) && (uint64_t) maze.w * maze.h > INT32_MAX) {
+      fprintf(stderr, "%s: too big to solve or check\n", load);
+      return 1;
+    }
+  } else {
+    // walls are numbered up to twice the cells in kruskal
+    if (w <= 0 || h <= 0 || (uint64_t) w * h > INT32_MAX) return usage(argv[0]);
+
+    Rng rng = rng_new(seed, 0);
+    maze = maze_new(w, h);
+    if (threads > 0) {
+      gen_tiled(&maze, threads, tile_size, seed);
+    } else {
+      gen->generate(&maze, &rng);
+    }
+  }
+  if (check && !maze_is_perfect(&maze)) {
+    fprintf(stderr, "not a perfect maze\n");
+    return 1;
+  }
+  Solution solution = {0};
+  if (solver != NULL) solution = solver->solve(&maze);
+  Bitmap* path = solver != NULL ? &solution.path : NULL;
+
+  if (save != NULL) {
+    FILE* out = fopen(save, "wb");
+    if (out == NULL || !maze_save(&maze, seed, out)) {
+      perror(save);
+      return 1;
+    }
+    fclose(out);
+  }
+  if (renderer != NULL) {
+    if (!render(&maze, renderer, path, stdout)) return usage(argv[0]);
+  } else if (save == NULL) {
+    render(&maze, "utf8", path, stdout);
+    render(&maze, "ascii", path, stdout);
+    render(&maze, "ascii-wide", path, stdout);
+  }
+  if (solver != NULL) {
+    fprintf(stderr, "%s: path of %zu cells, %zu expanded\n",
+      solver->name, solution.length, solution.expanded);
+    solution_free(&solution);
+  }
+  maze_free(&maze);
+
+  return 0;
+}